@@ -10,7 +10,7 @@ then
 fi
 
 # Source files
-SRCS="src/main.c src/image_loader.c src/gaussian_blur.c src/edge_detection.c src/ascii_converter.c src/utils.c"
+SRCS="src/main.c src/image_loader.c src/png_rows.c src/gaussian_blur.c src/edge_detection.c src/flow_dog.c src/ascii_converter.c src/cell_sampler.c src/batch.c src/bounded_queue.c src/stage_plan.c src/stream_pipeline.c src/thread_pool.c src/tile_pipeline.c src/utils.c"
 
 # Output files
 OUTPUT="ascii_generator"
@@ -1,6 +1,8 @@
 // ascii_converter.c
 
 #include "ascii_converter.h"
+#include "edge_detection.h"
+#include "thread_pool.h"
 #include "utils.h"
 #include <math.h>
 #include <stdio.h>
@@ -9,100 +11,407 @@
 
 #define MAX_INTENSITY 255
 
+// Smallest number of cell rows handed to a thread
+#define CELL_MIN_BAND_ROWS 8
+
 // ASCII characters for different intensity levels (from darkest to brightest)
 const char *ASCII_CHARS = " .:coP0?@\xe2\x96\xa0";  // UTF-8 encoding for ■
-const int ASCII_CHARS_LENGTH = 10;
 
 // ASCII characters for edges
 const char *EDGE_CHARS = "|-\\/";
 
-char* get_ascii_char(float intensity, int is_edge, int edge_direction) {
-    static char buffer[4];  // Buffer to hold multi-byte characters
-    if (is_edge) {
-        buffer[0] = EDGE_CHARS[edge_direction];
-        buffer[1] = '\0';
-    } else {
-        int index = (int)(intensity * (ASCII_CHARS_LENGTH - 1));
-        if (index == ASCII_CHARS_LENGTH - 1) {
-            // Handle the multi-byte ■ character
-            strcpy(buffer, "\xe2\x96\xa0");
+// Byte length of the UTF-8 sequence starting with `lead`
+static int utf8_sequence_length(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if ((lead & 0xe0) == 0xc0) return 2;
+    if ((lead & 0xf0) == 0xe0) return 3;
+    if ((lead & 0xf8) == 0xf0) return 4;
+    return 1;  // Stray continuation byte; keep it as its own glyph
+}
+
+void build_glyph_table(GlyphTable* table, const char* charset) {
+    const char* glyph_start[GLYPH_MAX_COUNT];
+    int glyph_length[GLYPH_MAX_COUNT];
+    int count = 0;
+
+    // Split the charset into code points, never reading past its terminator
+    for (const char* p = charset; *p && count < GLYPH_MAX_COUNT; ) {
+        int length = utf8_sequence_length((unsigned char)*p);
+        int available = 1;
+        while (available < length && p[available]) {
+            available++;
+        }
+        glyph_start[count] = p;
+        glyph_length[count] = available;
+        count++;
+        p += available;
+    }
+    if (count == 0) {
+        error_exit("Character set must contain at least one glyph");
+    }
+
+    // Same mapping as the old float path: index = intensity * (count - 1), truncated
+    for (int i = 0; i <= MAX_INTENSITY; i++) {
+        int index = i * (count - 1) / MAX_INTENSITY;
+        memcpy(table->bytes[i], glyph_start[index], glyph_length[index]);
+        table->length[i] = (uint8_t)glyph_length[index];
+    }
+    for (int d = 0; d < 4; d++) {
+        table->bytes[GLYPH_EDGE_BASE + d][0] = EDGE_CHARS[d];
+        table->length[GLYPH_EDGE_BASE + d] = 1;
+    }
+}
+
+// Decimal text of every 8-bit value, so emitting a color component is a copy instead of a printf
+static const char DECIMAL_DIGITS[256][4] = {
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15",
+    "16", "17", "18", "19", "20", "21", "22", "23", "24", "25", "26", "27", "28", "29", "30", "31",
+    "32", "33", "34", "35", "36", "37", "38", "39", "40", "41", "42", "43", "44", "45", "46", "47",
+    "48", "49", "50", "51", "52", "53", "54", "55", "56", "57", "58", "59", "60", "61", "62", "63",
+    "64", "65", "66", "67", "68", "69", "70", "71", "72", "73", "74", "75", "76", "77", "78", "79",
+    "80", "81", "82", "83", "84", "85", "86", "87", "88", "89", "90", "91", "92", "93", "94", "95",
+    "96", "97", "98", "99", "100", "101", "102", "103", "104", "105", "106", "107", "108", "109", "110", "111",
+    "112", "113", "114", "115", "116", "117", "118", "119", "120", "121", "122", "123", "124", "125", "126", "127",
+    "128", "129", "130", "131", "132", "133", "134", "135", "136", "137", "138", "139", "140", "141", "142", "143",
+    "144", "145", "146", "147", "148", "149", "150", "151", "152", "153", "154", "155", "156", "157", "158", "159",
+    "160", "161", "162", "163", "164", "165", "166", "167", "168", "169", "170", "171", "172", "173", "174", "175",
+    "176", "177", "178", "179", "180", "181", "182", "183", "184", "185", "186", "187", "188", "189", "190", "191",
+    "192", "193", "194", "195", "196", "197", "198", "199", "200", "201", "202", "203", "204", "205", "206", "207",
+    "208", "209", "210", "211", "212", "213", "214", "215", "216", "217", "218", "219", "220", "221", "222", "223",
+    "224", "225", "226", "227", "228", "229", "230", "231", "232", "233", "234", "235", "236", "237", "238", "239",
+    "240", "241", "242", "243", "244", "245", "246", "247", "248", "249", "250", "251", "252", "253", "254", "255",
+};
+
+static size_t decimal_length(uint8_t value) {
+    return value >= 100 ? 3 : value >= 10 ? 2 : 1;
+}
+
+size_t ansi_color_length(uint8_t r, uint8_t g, uint8_t b) {
+    return ANSI_COLOR_PREFIX_LENGTH + decimal_length(r) + decimal_length(g) + decimal_length(b) + 3;
+}
+
+size_t write_ansi_color(char* dst, uint8_t r, uint8_t g, uint8_t b) {
+    char* p = dst;
+    size_t length;
+
+    memcpy(p, ANSI_COLOR_PREFIX, ANSI_COLOR_PREFIX_LENGTH);
+    p += ANSI_COLOR_PREFIX_LENGTH;
+
+    length = decimal_length(r);
+    memcpy(p, DECIMAL_DIGITS[r], length);
+    p += length;
+    *p++ = ';';
+
+    length = decimal_length(g);
+    memcpy(p, DECIMAL_DIGITS[g], length);
+    p += length;
+    *p++ = ';';
+
+    length = decimal_length(b);
+    memcpy(p, DECIMAL_DIGITS[b], length);
+    p += length;
+    *p++ = 'm';
+
+    return (size_t)(p - dst);
+}
+
+int compute_ascii_height(int image_width, int image_height, int ascii_width) {
+    // Integer arithmetic so a working image built for this grid maps back to exactly the same rows
+    int height = (int)((long long)image_height * ascii_width / (2LL * image_width));
+    return max_int(height, 1);
+}
+
+ASCIIArt convert_to_ascii_with_color(const Image* image, const Image* edges, const ASCIIOptions* options, int ascii_width) {
+    CellSampler sampler = build_cell_sampler(image);
+    ASCIIArt ascii_art = convert_sampler_to_ascii(&sampler, edges, options, ascii_width);
+    free_cell_sampler(&sampler);
+
+    return ascii_art;
+}
+
+void build_color_quantizer(uint8_t* table, int levels) {
+    for (int i = 0; i <= MAX_INTENSITY; i++) {
+        if (levels < 2 || levels > MAX_INTENSITY) {
+            table[i] = (uint8_t)i;
         } else {
-            buffer[0] = ASCII_CHARS[index];
-            buffer[1] = '\0';
+            int step = (i * (levels - 1) + MAX_INTENSITY / 2) / MAX_INTENSITY;
+            table[i] = (uint8_t)(step * MAX_INTENSITY / (levels - 1));
         }
     }
-    return buffer;
 }
 
-char* get_color_code(float r, float g, float b) {
-    static char color_code[20];
-    snprintf(color_code, sizeof(color_code), "\x1b[38;2;%d;%d;%dm", 
-             (int)(r * 255), (int)(g * 255), (int)(b * 255));
-    return color_code;
+const uint8_t* prepare_color_quantizer(uint8_t* table, const ASCIIOptions* options) {
+    if (!(options->outputs & ASCII_OUTPUT_COLOR)) {
+        return NULL;
+    }
+    build_color_quantizer(table, options->color_levels);
+    return table;
+}
+
+CellGrid create_cell_grid(int width, int height) {
+    CellGrid grid;
+    grid.width = width;
+    grid.height = height;
+    grid.glyph = (uint16_t*)safe_malloc((size_t)width * height * sizeof(uint16_t));
+    grid.rgb = (uint8_t*)safe_malloc((size_t)width * height * 3);
+
+    return grid;
+}
+
+void set_cell(CellGrid* grid, size_t cell, const float* mean, int channels, uint8_t edge, const uint8_t* quantize) {
+    // Brightness is Rec. 709 luma, with the weights of convert_row_to_luma, so a color run and a
+    // run decoded straight to gray pick the same glyphs
+    float intensity = channels >= 3 ? (54.0f * mean[0] + 183.0f * mean[1] + 19.0f * mean[2]) / 256.0f : mean[0];
+
+    if (quantize) {
+        uint8_t* rgb = grid->rgb + cell * 3;
+        rgb[0] = quantize[(int)(mean[0] * MAX_INTENSITY + 0.5f)];
+        rgb[1] = channels >= 3 ? quantize[(int)(mean[1] * MAX_INTENSITY + 0.5f)] : rgb[0];
+        rgb[2] = channels >= 3 ? quantize[(int)(mean[2] * MAX_INTENSITY + 0.5f)] : rgb[0];
+    }
+
+    if (edge & EDGE_PIXEL_FLAG) {
+        grid->glyph[cell] = (uint16_t)(GLYPH_EDGE_BASE + (edge & EDGE_DIRECTION_MASK));
+    } else {
+        grid->glyph[cell] = (uint16_t)(intensity * MAX_INTENSITY + 0.5f);
+    }
 }
 
-ASCIIArt convert_to_ascii_with_color(const Image* image, const Image* edges, int ascii_width) {
-    ASCIIArt ascii_art;
-    ascii_art.width = ascii_width;
-    ascii_art.height = (int)((float)image->height / image->width * ascii_width * 0.5f);
+// Inputs and output of build_cell_grid, shared by its row bands
+typedef struct {
+    const CellSampler* sampler;
+    const Image* edges;
+    const uint8_t* quantize;
+    CellGrid* grid;
+} CellGridJob;
 
-    // Allocate more space for potential multi-byte characters and color codes
-    ascii_art.data = (char *)safe_malloc(ascii_art.width * ascii_art.height * 4 + ascii_art.height + 1);
-    ascii_art.color_data = (char *)safe_malloc(ascii_art.width * ascii_art.height * 30 + ascii_art.height + 1);
+static void cell_grid_band(int begin, int end, void* context) {
+    const CellGridJob* job = (const CellGridJob*)context;
+    const CellSampler* sampler = job->sampler;
+    const Image* edges = job->edges;
+    const uint8_t* quantize = job->quantize;
+    CellGrid* grid = job->grid;
+    int ascii_width = grid->width;
 
-    float scale_x = (float)image->width / ascii_width;
-    float scale_y = (float)image->height / ascii_art.height;
+    for (int y = begin; y < end; y++) {
+        int y0, y1;
+        get_cell_bounds(sampler->height, grid->height, y, &y0, &y1);
 
-    int data_index = 0;
-    int color_index = 0;
-    for (int y = 0; y < ascii_art.height; y++) {
         for (int x = 0; x < ascii_width; x++) {
-            int image_x = (int)(x * scale_x);
-            int image_y = (int)(y * scale_y);
-
-            if (image_x < image->width && image_y < image->height) {
-                float intensity = 0;
-                float r = 0, g = 0, b = 0;
-                for (int c = 0; c < image->channels; c++) {
-                    float pixel = get_pixel(image, image_x, image_y, c);
-                    intensity += pixel;
-                    if (c == 0) r = pixel;
-                    if (c == 1) g = pixel;
-                    if (c == 2) b = pixel;
+            int x0, x1;
+            get_cell_bounds(sampler->width, ascii_width, x, &x0, &x1);
+            size_t cell = (size_t)y * ascii_width + x;
+
+            // Average every pixel under the cell instead of point-sampling its corner
+            float mean[4];
+            sample_cell_mean(sampler, x0, y0, x1, y1, mean);
+
+            // Packed edge byte of the cell from detect_cell_edges; images without edges leave data NULL
+            uint8_t edge = 0;
+            if (edges->data && x < edges->width && y < edges->height) {
+                edge = edges->data[(size_t)y * edges->width + x];
+            }
+            set_cell(grid, cell, mean, sampler->channels, edge, quantize);
+        }
+    }
+}
+
+void set_cell_tone(CellGrid* grid, size_t cell, uint64_t tone_sum, int pixels) {
+    if (grid->glyph[cell] < GLYPH_EDGE_BASE) {
+        float mean = (float)tone_sum / ((float)XDOG_WHITE * pixels);
+        grid->glyph[cell] = (uint16_t)(mean * MAX_INTENSITY + 0.5f);
+    }
+}
+
+// Grid and tone field of apply_cell_tone, shared by its row bands
+typedef struct {
+    CellGrid* grid;
+    const ToneField* tone;
+} CellToneJob;
+
+static void cell_tone_band(int begin, int end, void* context) {
+    const CellToneJob* job = (const CellToneJob*)context;
+    CellGrid* grid = job->grid;
+    const ToneField* tone = job->tone;
+
+    for (int y = begin; y < end; y++) {
+        int y0, y1;
+        get_cell_bounds(tone->height, grid->height, y, &y0, &y1);
+
+        for (int x = 0; x < grid->width; x++) {
+            size_t cell = (size_t)y * grid->width + x;
+            if (grid->glyph[cell] >= GLYPH_EDGE_BASE) {
+                continue;
+            }
+
+            int x0, x1;
+            get_cell_bounds(tone->width, grid->width, x, &x0, &x1);
+            uint64_t sum = 0;
+            for (int ty = y0; ty < y1; ty++) {
+                const uint16_t* row = tone->data + (size_t)ty * tone->width;
+                for (int tx = x0; tx < x1; tx++) {
+                    sum += row[tx];
                 }
-                intensity /= image->channels;
-
-                int is_edge = (int)get_pixel(edges, image_x, image_y, 0);
-                int edge_direction = is_edge ? (int)(get_pixel(edges, image_x, image_y, 0) * 4) % 4 : 0;
-
-                char* ascii_char = get_ascii_char(intensity, is_edge, edge_direction);
-                char* color_code = get_color_code(r, g, b);
-
-                strncpy(&ascii_art.data[data_index], ascii_char, 4);
-                data_index += strlen(ascii_char);
-
-                strncpy(&ascii_art.color_data[color_index], color_code, 20);
-                color_index += strlen(color_code);
-                strncpy(&ascii_art.color_data[color_index], ascii_char, 4);
-                color_index += strlen(ascii_char);
-                strncpy(&ascii_art.color_data[color_index], "\x1b[0m", 5);
-                color_index += 4;
-            } else {
-                // Handle out-of-bounds case
-                ascii_art.data[data_index++] = ' ';
-                strncpy(&ascii_art.color_data[color_index], " ", 2);
-                color_index += 1;
             }
+            set_cell_tone(grid, cell, sum, (x1 - x0) * (y1 - y0));
         }
-        ascii_art.data[data_index++] = '\n';
-        ascii_art.color_data[color_index++] = '\n';
     }
-    ascii_art.data[data_index] = '\0';
-    ascii_art.color_data[color_index] = '\0';
+}
+
+void apply_cell_tone(CellGrid* grid, const ToneField* tone) {
+    CellToneJob job = { grid, tone };
+    parallel_for(grid->height, CELL_MIN_BAND_ROWS, cell_tone_band, &job);
+}
+
+CellGrid build_cell_grid(const CellSampler* sampler, const Image* edges, const ASCIIOptions* options, int ascii_width) {
+    uint8_t table[256];
+    const uint8_t* quantize = prepare_color_quantizer(table, options);
+
+    CellGrid grid = create_cell_grid(ascii_width, compute_ascii_height(sampler->width, sampler->height, ascii_width));
+
+    CellGridJob job = { sampler, edges, quantize, &grid };
+    parallel_for(grid.height, CELL_MIN_BAND_ROWS, cell_grid_band, &job);
+
+    return grid;
+}
+
+// Copy `length` bytes to dst + offset unless measuring (dst == NULL); returns the new offset
+static size_t emit(char* dst, size_t offset, const char* bytes, size_t length) {
+    if (dst) {
+        memcpy(dst + offset, bytes, length);
+    }
+    return offset + length;
+}
+
+// Plain text of one grid row. With dst == NULL nothing is written and only the size is
+// returned, so the same walk sizes the buffer exactly and then fills it.
+static size_t render_plain_row(const CellGrid* grid, const GlyphTable* glyphs, int y, char* dst) {
+    const uint16_t* row = grid->glyph + (size_t)y * grid->width;
+    size_t offset = 0;
+
+    for (int x = 0; x < grid->width; x++) {
+        offset = emit(dst, offset, glyphs->bytes[row[x]], glyphs->length[row[x]]);
+    }
+    return emit(dst, offset, "\n", 1);
+}
+
+// Colored text of one grid row, measured or written the same way as render_plain_row
+static size_t render_color_row(const CellGrid* grid, const GlyphTable* glyphs, bool coalesce, int y, char* dst) {
+    size_t offset = 0;
+
+    // Packed RGB of the escape currently in effect; -1 forces one at the start of the row
+    long active_color = -1;
+
+    for (int x = 0; x < grid->width; x++) {
+        size_t cell = (size_t)y * grid->width + x;
+        const uint8_t* rgb = grid->rgb + cell * 3;
+        const char* glyph = glyphs->bytes[grid->glyph[cell]];
+        int glyph_length = glyphs->length[grid->glyph[cell]];
+
+        if (!coalesce) {
+            offset += dst ? write_ansi_color(dst + offset, rgb[0], rgb[1], rgb[2]) : ansi_color_length(rgb[0], rgb[1], rgb[2]);
+            offset = emit(dst, offset, glyph, glyph_length);
+            offset = emit(dst, offset, ANSI_RESET, ANSI_RESET_LENGTH);
+            continue;
+        }
+
+        // A space shows no foreground, so it can take whatever color is active
+        long color = ((long)rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+        int is_blank = glyph_length == 1 && glyph[0] == ' ';
+        if (color != active_color && !is_blank) {
+            offset += dst ? write_ansi_color(dst + offset, rgb[0], rgb[1], rgb[2]) : ansi_color_length(rgb[0], rgb[1], rgb[2]);
+            active_color = color;
+        }
+        offset = emit(dst, offset, glyph, glyph_length);
+    }
+    if (coalesce && active_color >= 0) {
+        offset = emit(dst, offset, ANSI_RESET, ANSI_RESET_LENGTH);
+    }
+    return emit(dst, offset, "\n", 1);
+}
+
+// One text rendering of the grid. Rows are measured in parallel, their offsets fixed by a prefix
+// sum, and then every row is written straight to its place in the buffer.
+typedef struct {
+    const CellGrid* grid;
+    const ASCIIOptions* options;
+    int color;
+    size_t* row_offsets;  // height + 1 entries
+    char* dst;
+} RenderJob;
+
+static size_t render_row(const RenderJob* job, int y, char* dst) {
+    if (job->color) {
+        return render_color_row(job->grid, job->options->glyphs, job->options->coalesce_colors, y, dst);
+    }
+    return render_plain_row(job->grid, job->options->glyphs, y, dst);
+}
+
+static void measure_rows_band(int begin, int end, void* context) {
+    const RenderJob* job = (const RenderJob*)context;
+    for (int y = begin; y < end; y++) {
+        job->row_offsets[y + 1] = render_row(job, y, NULL);
+    }
+}
+
+static void write_rows_band(int begin, int end, void* context) {
+    const RenderJob* job = (const RenderJob*)context;
+    for (int y = begin; y < end; y++) {
+        render_row(job, y, job->dst + job->row_offsets[y]);
+    }
+}
+
+static char* render_text(const CellGrid* grid, const ASCIIOptions* options, int color, size_t* length) {
+    size_t* row_offsets = (size_t*)safe_malloc(((size_t)grid->height + 1) * sizeof(size_t));
+    RenderJob job = { grid, options, color, row_offsets, NULL };
+
+    // Measure first, then allocate exactly what the text needs and fill it
+    row_offsets[0] = 0;
+    parallel_for(grid->height, CELL_MIN_BAND_ROWS, measure_rows_band, &job);
+    for (int y = 0; y < grid->height; y++) {
+        row_offsets[y + 1] += row_offsets[y];
+    }
+
+    *length = row_offsets[grid->height];
+    job.dst = (char*)safe_malloc(*length + 1);
+    parallel_for(grid->height, CELL_MIN_BAND_ROWS, write_rows_band, &job);
+    job.dst[*length] = '\0';
+
+    free(row_offsets);
+    return job.dst;
+}
+
+ASCIIArt render_cell_grid(const CellGrid* grid, const ASCIIOptions* options) {
+    ASCIIArt ascii_art = {0};
+    ascii_art.width = grid->width;
+    ascii_art.height = grid->height;
+
+    if (options->outputs & ASCII_OUTPUT_PLAIN) {
+        ascii_art.data = render_text(grid, options, 0, &ascii_art.data_length);
+    }
+    if (options->outputs & ASCII_OUTPUT_COLOR) {
+        ascii_art.color_data = render_text(grid, options, 1, &ascii_art.color_data_length);
+    }
+
+    return ascii_art;
+}
+
+ASCIIArt convert_sampler_to_ascii(const CellSampler* sampler, const Image* edges, const ASCIIOptions* options, int ascii_width) {
+    CellGrid grid = build_cell_grid(sampler, edges, options, ascii_width);
+    ASCIIArt ascii_art = render_cell_grid(&grid, options);
+    free_cell_grid(&grid);
 
     return ascii_art;
 }
 
+void free_cell_grid(CellGrid* grid) {
+    free(grid->glyph);
+    free(grid->rgb);
+    grid->glyph = NULL;
+    grid->rgb = NULL;
+    grid->width = grid->height = 0;
+}
+
 void free_ascii_art(ASCIIArt *ascii_art) {
     if (ascii_art->data) {
         free(ascii_art->data);
@@ -112,16 +421,23 @@ void free_ascii_art(ASCIIArt *ascii_art) {
         free(ascii_art->color_data);
         ascii_art->color_data = NULL;
     }
+    ascii_art->data_length = ascii_art->color_data_length = 0;
     ascii_art->width = ascii_art->height = 0;
 }
 
 void save_ascii_art(const ASCIIArt *ascii_art, const char *filename) {
+    if (!write_ascii_art(ascii_art, filename)) {
+        error_exit("Error opening file %s for writing", filename);
+    }
+}
+
+bool write_ascii_art(const ASCIIArt *ascii_art, const char *filename) {
     FILE *file = fopen(filename, "w");
     if (file == NULL) {
-        error_exit("Error opening file %s for writing", filename);
+        return false;
     }
 
     // Always save the non-color version (ascii_art->data) to the file
-    fputs(ascii_art->data, file);
-    fclose(file);
+    size_t written = fwrite(ascii_art->data, 1, ascii_art->data_length, file);
+    return fclose(file) == 0 && written == ascii_art->data_length;
 }
\ No newline at end of file
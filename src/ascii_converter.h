@@ -3,18 +3,121 @@
 #ifndef ASCII_CONVERTER_H
 #define ASCII_CONVERTER_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "image_loader.h"
+#include "cell_sampler.h"
+#include "edge_detection.h"
+
+// Longest glyph in bytes (one UTF-8 code point)
+#define GLYPH_MAX_BYTES 4
+
+// Most glyphs a charset may contain
+#define GLYPH_MAX_COUNT 256
+
+// 24-bit foreground color escape ("\x1b[38;2;R;G;Bm") and the attribute reset ("\x1b[0m")
+#define ANSI_COLOR_PREFIX "\x1b[38;2;"
+#define ANSI_COLOR_PREFIX_LENGTH 7
+#define ANSI_COLOR_MAX_BYTES 19
+#define ANSI_RESET "\x1b[0m"
+#define ANSI_RESET_LENGTH 4
+
+// Default intensity ramp (darkest to brightest, UTF-8) and edge characters ("|-\\/")
+extern const char *ASCII_CHARS;
+extern const char *EDGE_CHARS;
+
+// Glyph table slots: one per 8-bit intensity, then one per EDGE_CHARS direction
+#define GLYPH_EDGE_BASE 256
+#define GLYPH_TABLE_SIZE (GLYPH_EDGE_BASE + 4)
+
+// Intensity-to-glyph lookup built once per charset, so converting a cell is a table read
+typedef struct {
+    char bytes[GLYPH_TABLE_SIZE][GLYPH_MAX_BYTES];  // Not NUL-terminated
+    uint8_t length[GLYPH_TABLE_SIZE];
+} GlyphTable;
+
+// Which text representations a conversion produces
+enum {
+    ASCII_OUTPUT_PLAIN = 1 << 0,  // ASCIIArt.data
+    ASCII_OUTPUT_COLOR = 1 << 1   // ASCIIArt.color_data
+};
+
+// Rendering options shared by the converters
+typedef struct {
+    const GlyphTable* glyphs;
+    bool coalesce_colors;  // Emit a color escape only when the color changes, with one reset per row
+    int color_levels;      // Quantize each color component to this many levels first (0 keeps all 256)
+    int outputs;           // ASCII_OUTPUT_* flags; representations not requested are left NULL
+} ASCIIOptions;
+
+// Per-cell result of sampling, rendered to text in a separate pass
+typedef struct {
+    int width;
+    int height;
+    uint16_t* glyph;  // GlyphTable slot of each cell
+    uint8_t* rgb;     // Three already-quantized bytes per cell
+} CellGrid;
 
 // Structure to hold ASCII art result
 typedef struct {
     char* data;
     char* color_data;  // New field for color information
+    size_t data_length;        // Bytes in data, excluding the terminator
+    size_t color_data_length;  // Bytes in color_data, excluding the terminator
     int width;
     int height;
 } ASCIIArt;
 
+// Number of ASCII rows for an image rendered ascii_width columns wide (cells are twice as tall as wide)
+int compute_ascii_height(int image_width, int image_height, int ascii_width);
+
+// Build the glyph table for a UTF-8 charset ordered from darkest to brightest
+void build_glyph_table(GlyphTable* table, const char* charset);
+
+// Write the color escape for (r, g, b) at dst, returning the exact number of bytes written
+size_t write_ansi_color(char* dst, uint8_t r, uint8_t g, uint8_t b);
+
+// Number of bytes write_ansi_color produces for (r, g, b)
+size_t ansi_color_length(uint8_t r, uint8_t g, uint8_t b);
+
 // Convert image to ASCII art with color
-ASCIIArt convert_to_ascii_with_color(const Image* image, const Image* edges, int ascii_width);
+ASCIIArt convert_to_ascii_with_color(const Image* image, const Image* edges, const ASCIIOptions* options, int ascii_width);
+
+// Convert a prebuilt cell sampler to ASCII art; re-rendering at another width only costs O(cells)
+ASCIIArt convert_sampler_to_ascii(const CellSampler* sampler, const Image* edges, const ASCIIOptions* options, int ascii_width);
+
+// Sample every cell of an ascii_width-wide grid: glyph slot plus quantized color. edges holds one
+// packed edge byte per cell (detect_cell_edges at the grid size), or no data for no edges.
+CellGrid build_cell_grid(const CellSampler* sampler, const Image* edges, const ASCIIOptions* options, int ascii_width);
+
+// Allocate an uninitialized width x height grid
+CellGrid create_cell_grid(int width, int height);
+
+// Component lookup (256 entries) that snaps each 8-bit value to the nearest of `levels` evenly
+// spaced levels; levels outside [2, 255] keep every value
+void build_color_quantizer(uint8_t* table, int levels);
+
+// The quantizer for options built into table, or NULL when no colored text is requested and the
+// cell colors are never read
+const uint8_t* prepare_color_quantizer(uint8_t* table, const ASCIIOptions* options);
+
+// Fill one cell from its per-channel mean in [0, 1] and its packed edge byte (0 for none). A NULL
+// quantize leaves the cell color unset.
+void set_cell(CellGrid* grid, size_t cell, const float* mean, int channels, uint8_t edge, const uint8_t* quantize);
+
+// Replace the brightness glyph of a cell that is not an edge with the one for the mean of its
+// `pixels` tone values (ToneField units), which sum to tone_sum
+void set_cell_tone(CellGrid* grid, size_t cell, uint64_t tone_sum, int pixels);
+
+// Replace the brightness glyph of every cell that is not an edge with the mean of `tone` over the
+// cell, so the glyph density follows the tone field (apply_xdog) while colors stay the image's
+void apply_cell_tone(CellGrid* grid, const ToneField* tone);
+
+// Render the requested text representations of a cell grid into exactly sized buffers
+ASCIIArt render_cell_grid(const CellGrid* grid, const ASCIIOptions* options);
+
+// Free CellGrid structure
+void free_cell_grid(CellGrid* grid);
 
 // Free ASCII art structure
 void free_ascii_art(ASCIIArt* ascii_art);
@@ -22,4 +125,7 @@ void free_ascii_art(ASCIIArt* ascii_art);
 // Save ASCII art to file
 void save_ascii_art(const ASCIIArt* ascii_art, const char* filename);
 
+// Save ASCII art to file, returning false instead of exiting when it cannot be written
+bool write_ascii_art(const ASCIIArt* ascii_art, const char* filename);
+
 #endif // ASCII_CONVERTER_H
\ No newline at end of file
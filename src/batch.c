@@ -0,0 +1,328 @@
+// batch.c
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "bounded_queue.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <dirent.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef THREAD_POOL_SERIAL
+#include <pthread.h>
+#endif
+
+// Queue slots per consuming thread between pipeline stages; bounds the images in flight
+#define PIPELINE_SLOTS_PER_THREAD 2
+
+// Extensions stb_image decodes; other files in a batch directory are skipped
+static const char* IMAGE_EXTENSIONS[] = {
+    "png", "jpg", "jpeg", "bmp", "tga", "gif", "psd", "hdr", "pic", "ppm", "pgm", "pnm"
+};
+
+static bool has_image_extension(const char* path) {
+    char extension[8];
+    const char* ext = get_file_extension(path);
+    if (strlen(ext) >= sizeof(extension)) {
+        return false;
+    }
+    strcpy(extension, ext);
+    string_to_lower(extension);
+
+    for (size_t i = 0; i < sizeof(IMAGE_EXTENSIONS) / sizeof(IMAGE_EXTENSIONS[0]); i++) {
+        if (strcmp(extension, IMAGE_EXTENSIONS[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_regular_file(const char* path) {
+    struct stat buffer;
+    return stat(path, &buffer) == 0 && S_ISREG(buffer.st_mode);
+}
+
+static void add_input(BatchInputs* inputs, int* capacity, const char* path) {
+    if (inputs->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        inputs->paths = (char**)safe_realloc(inputs->paths, *capacity * sizeof(char*));
+    }
+    size_t length = strlen(path);
+    inputs->paths[inputs->count] = (char*)safe_malloc(length + 1);
+    memcpy(inputs->paths[inputs->count], path, length + 1);
+    inputs->count++;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void collect_directory(BatchInputs* inputs, int* capacity, const char* directory) {
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        error_exit("Cannot open directory %s", directory);
+    }
+
+    size_t directory_length = strlen(directory);
+    char* path = NULL;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!has_image_extension(entry->d_name)) {
+            continue;
+        }
+        path = (char*)safe_realloc(path, directory_length + strlen(entry->d_name) + 2);
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        if (is_regular_file(path)) {
+            add_input(inputs, capacity, path);
+        }
+    }
+    free(path);
+    closedir(dir);
+
+    // readdir order is arbitrary; keep runs reproducible
+    qsort(inputs->paths, inputs->count, sizeof(char*), compare_paths);
+}
+
+static void collect_stdin(BatchInputs* inputs, int* capacity) {
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &line_capacity, stdin)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length > 0) {
+            add_input(inputs, capacity, line);
+        }
+    }
+    free(line);
+}
+
+static void collect_glob(BatchInputs* inputs, int* capacity, const char* pattern) {
+    glob_t matches;
+    if (glob(pattern, 0, NULL, &matches) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        if (is_regular_file(matches.gl_pathv[i])) {
+            add_input(inputs, capacity, matches.gl_pathv[i]);
+        }
+    }
+    globfree(&matches);
+}
+
+BatchInputs collect_batch_inputs(const char* source) {
+    BatchInputs inputs = { NULL, 0 };
+    int capacity = 0;
+    struct stat buffer;
+
+    if (strcmp(source, "-") == 0) {
+        collect_stdin(&inputs, &capacity);
+    } else if (stat(source, &buffer) == 0 && S_ISDIR(buffer.st_mode)) {
+        collect_directory(&inputs, &capacity, source);
+    } else {
+        collect_glob(&inputs, &capacity, source);
+    }
+
+    if (inputs.count == 0) {
+        error_exit("No input images found for %s", source);
+    }
+    return inputs;
+}
+
+// Tally per-input sizes (-1 for failures) into a report
+static BatchReport summarize(const long long* sizes, int count, double seconds) {
+    BatchReport report = {0};
+    report.seconds = seconds;
+
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] < 0) {
+            report.failed++;
+        } else {
+            report.converted++;
+            report.input_bytes += sizes[i];
+        }
+    }
+    return report;
+}
+
+static long long converted_size(const char* path) {
+    long long size = get_file_size(path);
+    return size > 0 ? size : 0;
+}
+
+// Per-input results are written to their own slot, so the items need no locking
+typedef struct {
+    const BatchInputs* inputs;
+    BatchItemFunction fn;
+    void* context;
+    long long* sizes;  // Input file size, or -1 when the item failed
+} BatchJob;
+
+static void batch_band(int begin, int end, void* context) {
+    const BatchJob* job = (const BatchJob*)context;
+
+    for (int i = begin; i < end; i++) {
+        const char* path = job->inputs->paths[i];
+        job->sizes[i] = job->fn(path, job->context) ? converted_size(path) : -1;
+    }
+}
+
+BatchReport run_batch(const BatchInputs* inputs, BatchItemFunction fn, void* context) {
+    BatchJob job = { inputs, fn, context, NULL };
+    job.sizes = (long long*)safe_malloc(inputs->count * sizeof(long long));
+
+    double start = get_time_seconds();
+    parallel_for_stealing(inputs->count, batch_band, &job);
+    BatchReport report = summarize(job.sizes, inputs->count, get_time_seconds() - start);
+
+    free(job.sizes);
+    return report;
+}
+
+#ifndef THREAD_POOL_SERIAL
+
+// An input travelling down the pipeline; a NULL item tells a stage thread to stop
+typedef struct {
+    int index;
+    void* data;
+} PipelineItem;
+
+typedef struct {
+    const BatchInputs* inputs;
+    const BatchStages* stages;
+    BatchParallelism parallelism;
+    long long* sizes;
+    int next_input;         // Claimed with atomic increments by the decoders
+    int active_decoders;    // The last decoder to finish stops the processors
+    int active_processors;  // The last processor to finish stops the writers
+    BoundedQueue decoded;
+    BoundedQueue processed;
+} Pipeline;
+
+static void* decode_main(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    const BatchStages* stages = pipeline->stages;
+
+    for (;;) {
+        int index = __atomic_fetch_add(&pipeline->next_input, 1, __ATOMIC_RELAXED);
+        if (index >= pipeline->inputs->count) {
+            break;
+        }
+        void* data = stages->decode(pipeline->inputs->paths[index], stages->context);
+        if (!data) {
+            pipeline->sizes[index] = -1;
+            continue;
+        }
+        PipelineItem* item = (PipelineItem*)safe_malloc(sizeof(PipelineItem));
+        item->index = index;
+        item->data = data;
+        bounded_queue_push(&pipeline->decoded, item);
+    }
+
+    if (__atomic_sub_fetch(&pipeline->active_decoders, 1, __ATOMIC_ACQ_REL) == 0) {
+        for (int i = 0; i < pipeline->parallelism.process; i++) {
+            bounded_queue_push(&pipeline->decoded, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void* process_main(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    PipelineItem* item;
+
+    while ((item = (PipelineItem*)bounded_queue_pop(&pipeline->decoded)) != NULL) {
+        item->data = pipeline->stages->process(item->data, pipeline->stages->context);
+        bounded_queue_push(&pipeline->processed, item);
+    }
+
+    if (__atomic_sub_fetch(&pipeline->active_processors, 1, __ATOMIC_ACQ_REL) == 0) {
+        for (int i = 0; i < pipeline->parallelism.write; i++) {
+            bounded_queue_push(&pipeline->processed, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void* write_main(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    PipelineItem* item;
+
+    while ((item = (PipelineItem*)bounded_queue_pop(&pipeline->processed)) != NULL) {
+        const char* path = pipeline->inputs->paths[item->index];
+        bool written = pipeline->stages->write(path, item->data, pipeline->stages->context);
+        pipeline->sizes[item->index] = written ? converted_size(path) : -1;
+        free(item);
+    }
+    return NULL;
+}
+
+#endif
+
+BatchReport run_batch_pipeline(const BatchInputs* inputs, const BatchStages* stages, const BatchParallelism* parallelism) {
+    long long* sizes = (long long*)safe_malloc(inputs->count * sizeof(long long));
+    double start = get_time_seconds();
+
+#ifdef THREAD_POOL_SERIAL
+    (void)parallelism;
+    for (int i = 0; i < inputs->count; i++) {
+        void* data = stages->decode(inputs->paths[i], stages->context);
+        sizes[i] = -1;
+        if (data) {
+            data = stages->process(data, stages->context);
+            sizes[i] = stages->write(inputs->paths[i], data, stages->context) ? converted_size(inputs->paths[i]) : -1;
+        }
+    }
+#else
+    Pipeline pipeline;
+    pipeline.inputs = inputs;
+    pipeline.stages = stages;
+    pipeline.parallelism.decode = max_int(parallelism->decode, 1);
+    pipeline.parallelism.process = max_int(parallelism->process, 1);
+    pipeline.parallelism.write = max_int(parallelism->write, 1);
+    pipeline.sizes = sizes;
+    pipeline.next_input = 0;
+    pipeline.active_decoders = pipeline.parallelism.decode;
+    pipeline.active_processors = pipeline.parallelism.process;
+    bounded_queue_init(&pipeline.decoded, pipeline.parallelism.process * PIPELINE_SLOTS_PER_THREAD);
+    bounded_queue_init(&pipeline.processed, pipeline.parallelism.write * PIPELINE_SLOTS_PER_THREAD);
+
+    int thread_count = pipeline.parallelism.decode + pipeline.parallelism.process + pipeline.parallelism.write;
+    pthread_t* threads = (pthread_t*)safe_malloc(thread_count * sizeof(pthread_t));
+    for (int i = 0; i < thread_count; i++) {
+        void* (*stage_main)(void*) = i < pipeline.parallelism.decode ? decode_main
+                                   : i < pipeline.parallelism.decode + pipeline.parallelism.process ? process_main
+                                   : write_main;
+        if (pthread_create(&threads[i], NULL, stage_main, &pipeline) != 0) {
+            error_exit("Failed to start pipeline thread");
+        }
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    bounded_queue_destroy(&pipeline.decoded);
+    bounded_queue_destroy(&pipeline.processed);
+#endif
+
+    BatchReport report = summarize(sizes, inputs->count, get_time_seconds() - start);
+    free(sizes);
+    return report;
+}
+
+void free_batch_inputs(BatchInputs* inputs) {
+    for (int i = 0; i < inputs->count; i++) {
+        free(inputs->paths[i]);
+    }
+    free(inputs->paths);
+    inputs->paths = NULL;
+    inputs->count = 0;
+}
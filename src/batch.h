@@ -0,0 +1,57 @@
+// batch.h
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+// Image paths of one batch run
+typedef struct {
+    char** paths;
+    int count;
+} BatchInputs;
+
+// Converts one input; returns false (after reporting why) when it could not be converted
+typedef bool (*BatchItemFunction)(const char* path, void* context);
+
+// Aggregate result of run_batch
+typedef struct {
+    int converted;
+    int failed;
+    long long input_bytes;  // Total file size of the converted inputs
+    double seconds;         // Wall time of the whole run
+} BatchReport;
+
+// Stage callbacks of the pipelined engine. process takes ownership of what decode returned and
+// write of what process returned. decode returns NULL (after reporting why) when the input cannot
+// be read; write returns false when the output cannot be saved.
+typedef struct {
+    void* (*decode)(const char* path, void* context);
+    void* (*process)(void* decoded, void* context);
+    bool (*write)(const char* path, void* processed, void* context);
+    void* context;
+} BatchStages;
+
+// Threads given to each stage of the pipelined engine
+typedef struct {
+    int decode;
+    int process;
+    int write;
+} BatchParallelism;
+
+// Expand a batch source: a directory (its image files), "-" (one path per line on stdin) or a
+// glob pattern. Exits when nothing matches.
+BatchInputs collect_batch_inputs(const char* source);
+
+// Run fn on every input across the thread pool, balancing uneven images by work stealing
+BatchReport run_batch(const BatchInputs* inputs, BatchItemFunction fn, void* context);
+
+// Run decode, process and write as separate stages, each on its own threads, connected by
+// bounded queues: a stage that gets ahead blocks instead of piling up decoded images, and I/O in
+// one stage overlaps computation in the others
+BatchReport run_batch_pipeline(const BatchInputs* inputs, const BatchStages* stages, const BatchParallelism* parallelism);
+
+// Free BatchInputs structure
+void free_batch_inputs(BatchInputs* inputs);
+
+#endif // BATCH_H
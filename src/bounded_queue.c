@@ -0,0 +1,102 @@
+// bounded_queue.c
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bounded_queue.h"
+#include "utils.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+void bounded_queue_init(BoundedQueue* queue, int capacity) {
+    size_t size = 2;
+    while (size < (size_t)capacity) {
+        size *= 2;
+    }
+
+    queue->cells = (QueueCell*)safe_malloc(size * sizeof(QueueCell));
+    queue->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+        queue->cells[i].value = NULL;
+    }
+    queue->head = 0;
+    queue->tail = 0;
+    sem_init(&queue->free_slots, 0, (unsigned)size);
+    sem_init(&queue->filled_slots, 0, 0);
+}
+
+// A cell at position pos is free for the producer when its sequence equals pos, and holds the
+// item for the consumer when its sequence equals pos + 1 (D. Vyukov's bounded MPMC queue)
+static bool try_push(BoundedQueue* queue, void* value) {
+    size_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        QueueCell* cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->value = value;
+                __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static bool try_pop(BoundedQueue* queue, void** value) {
+    size_t pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    for (;;) {
+        QueueCell* cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *value = cell->value;
+                __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void wait_semaphore(sem_t* semaphore) {
+    while (sem_wait(semaphore) != 0 && errno == EINTR) {
+    }
+}
+
+void bounded_queue_push(BoundedQueue* queue, void* value) {
+    // The semaphore guarantees a free slot; the one at the tail may still be finishing its pop
+    wait_semaphore(&queue->free_slots);
+    while (!try_push(queue, value)) {
+        sched_yield();
+    }
+    sem_post(&queue->filled_slots);
+}
+
+void* bounded_queue_pop(BoundedQueue* queue) {
+    void* value;
+    wait_semaphore(&queue->filled_slots);
+    while (!try_pop(queue, &value)) {
+        sched_yield();
+    }
+    sem_post(&queue->free_slots);
+    return value;
+}
+
+void bounded_queue_destroy(BoundedQueue* queue) {
+    sem_destroy(&queue->free_slots);
+    sem_destroy(&queue->filled_slots);
+    free(queue->cells);
+    queue->cells = NULL;
+}
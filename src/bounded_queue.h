@@ -0,0 +1,42 @@
+// bounded_queue.h
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <semaphore.h>
+#include <stddef.h>
+
+// One slot of the ring; sequence tells producers and consumers whose turn the slot is
+typedef struct {
+    size_t sequence;
+    void* value;
+} QueueCell;
+
+// Fixed-capacity multi-producer multi-consumer queue of pointers. Slots are claimed with atomic
+// compare-and-swap on head and tail (no lock); the two semaphores only put a thread to sleep
+// while the queue is full or empty, which is what gives a pipeline its back-pressure.
+typedef struct {
+    QueueCell* cells;
+    size_t mask;
+    char pad0[64];
+    size_t head;  // Next position to pop
+    char pad1[64];
+    size_t tail;  // Next position to push
+    char pad2[64];
+    sem_t free_slots;
+    sem_t filled_slots;
+} BoundedQueue;
+
+// Create a queue holding at least `capacity` items (rounded up to a power of two)
+void bounded_queue_init(BoundedQueue* queue, int capacity);
+
+// Append an item, waiting while the queue is full
+void bounded_queue_push(BoundedQueue* queue, void* value);
+
+// Remove the oldest item, waiting while the queue is empty
+void* bounded_queue_pop(BoundedQueue* queue);
+
+// Free a queue nobody is using any more
+void bounded_queue_destroy(BoundedQueue* queue);
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,104 @@
+// cell_sampler.c
+
+#include "cell_sampler.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <stdlib.h>
+
+// Smallest unit of work handed to a thread: rows for the prefix pass, table entries for the columns
+#define SAT_MIN_BAND_ROWS 32
+#define SAT_MIN_BAND_COLUMNS 1024
+
+// Table under construction, shared by the two passes
+typedef struct {
+    const Image* image;
+    uint32_t* sums;
+    size_t stride;
+} SamplerJob;
+
+// First pass: running sum along each row, rows independent of each other
+static void row_prefix_band(int begin, int end, void* context) {
+    const SamplerJob* job = (const SamplerJob*)context;
+    const Image* image = job->image;
+    uint32_t row_sum[4];
+
+    for (int y = begin; y < end; y++) {
+        const uint8_t* src = image->data + (size_t)y * image->width * image->channels;
+        uint32_t* dst = job->sums + (size_t)(y + 1) * job->stride;
+
+        for (int c = 0; c < image->channels; c++) {
+            row_sum[c] = 0;
+        }
+        for (int x = 0; x < image->width; x++) {
+            for (int c = 0; c < image->channels; c++) {
+                row_sum[c] += src[x * image->channels + c];
+                dst[(size_t)(x + 1) * image->channels + c] = row_sum[c];
+            }
+        }
+    }
+}
+
+// Second pass: accumulate down a strip of columns, a contiguous run of each row at a time
+static void column_sum_band(int begin, int end, void* context) {
+    const SamplerJob* job = (const SamplerJob*)context;
+
+    for (int y = 1; y < job->image->height; y++) {
+        const uint32_t* above = job->sums + (size_t)y * job->stride;
+        uint32_t* dst = job->sums + (size_t)(y + 1) * job->stride;
+        for (int i = begin; i < end; i++) {
+            dst[i] += above[i];
+        }
+    }
+}
+
+// Sums are kept in uint32_t and allowed to wrap: rectangle sums are differences of
+// table entries, so they come out exact as long as a single cell holds less than
+// 2^32 / 255 pixels (about 16 million), which is far beyond any real cell size.
+CellSampler build_cell_sampler(const Image* image) {
+    CellSampler sampler;
+    sampler.width = image->width;
+    sampler.height = image->height;
+    sampler.channels = image->channels;
+
+    size_t stride = (size_t)(image->width + 1) * image->channels;
+    sampler.sums = (uint32_t*)safe_calloc(stride * (image->height + 1), sizeof(uint32_t));
+
+    SamplerJob job = { image, sampler.sums, stride };
+    parallel_for(image->height, SAT_MIN_BAND_ROWS, row_prefix_band, &job);
+    parallel_for((int)stride, SAT_MIN_BAND_COLUMNS, column_sum_band, &job);
+
+    return sampler;
+}
+
+void get_cell_bounds(int size, int cells, int index, int* start, int* end) {
+    *start = (int)((long long)index * size / cells);
+    *end = (int)((long long)(index + 1) * size / cells);
+
+    // More cells than pixels: every cell still covers at least one pixel
+    if (*end <= *start) {
+        *start = min_int(*start, size - 1);
+        *end = *start + 1;
+    }
+}
+
+void sample_cell_mean(const CellSampler* sampler, int x0, int y0, int x1, int y1, float* mean) {
+    size_t stride = (size_t)(sampler->width + 1) * sampler->channels;
+    const uint32_t* top = sampler->sums + (size_t)y0 * stride;
+    const uint32_t* bottom = sampler->sums + (size_t)y1 * stride;
+    float scale = 1.0f / (255.0f * (x1 - x0) * (y1 - y0));
+
+    for (int c = 0; c < sampler->channels; c++) {
+        size_t left = (size_t)x0 * sampler->channels + c;
+        size_t right = (size_t)x1 * sampler->channels + c;
+        uint32_t sum = bottom[right] - bottom[left] - top[right] + top[left];
+        mean[c] = sum * scale;
+    }
+}
+
+void free_cell_sampler(CellSampler* sampler) {
+    if (sampler->sums) {
+        free(sampler->sums);
+        sampler->sums = NULL;
+    }
+    sampler->width = sampler->height = sampler->channels = 0;
+}
@@ -0,0 +1,30 @@
+// cell_sampler.h
+
+#ifndef CELL_SAMPLER_H
+#define CELL_SAMPLER_H
+
+#include <stdint.h>
+#include "image_loader.h"
+
+// Summed area table over every channel of an image, so the mean of any
+// rectangle is four lookups regardless of its size
+typedef struct {
+    int width;
+    int height;
+    int channels;
+    uint32_t* sums;  // (width + 1) x (height + 1) x channels, first row and column are zero
+} CellSampler;
+
+// Build the summed area table for an image (O(pixels), done once per image)
+CellSampler build_cell_sampler(const Image* image);
+
+// Pixel range [start, end) covered by cell `index` when `size` pixels are split into `cells` cells
+void get_cell_bounds(int size, int cells, int index, int* start, int* end);
+
+// Mean of each channel over the rectangle [x0, x1) x [y0, y1), in [0, 1]
+void sample_cell_mean(const CellSampler* sampler, int x0, int y0, int x1, int y1, float* mean);
+
+// Free CellSampler structure
+void free_cell_sampler(CellSampler* sampler);
+
+#endif // CELL_SAMPLER_H
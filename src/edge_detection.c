@@ -1,99 +1,606 @@
 // edge_detection.c
 
 #include "edge_detection.h"
+#include "cell_sampler.h"
 #include "gaussian_blur.h"
+#include "thread_pool.h"
 #include "utils.h"
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define PI 3.14159265358979323846
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Smallest number of rows handed to a thread
+#define EDGE_MIN_BAND_ROWS 16
+
+// Smallest number of cell rows handed to a thread by detect_cell_edges
+#define EDGE_MIN_BAND_CELL_ROWS 4
+
+// State shared with the fused difference/threshold step of the DoG blur
+typedef struct {
+    const Image* blur1;
+    Image* dog;
+    float tau;
+    float threshold;
+} DoGContext;
+
+// Called with each row of blur2 as the last vertical pass finishes it
+static void dog_threshold_row(int y, const uint8_t* blur2_row, void* context) {
+    DoGContext* ctx = (DoGContext*)context;
+    int channels = ctx->blur1->channels;
+    int width = ctx->blur1->width;
+    const uint8_t* blur1_row = ctx->blur1->data + (size_t)y * width * channels;
+    uint8_t* dog_row = ctx->dog->data + (size_t)y * width;
+
+    // Same test as mean_c(blur1 - tau * blur2) / 255 >= threshold, without the per-pixel divides
+    float limit = ctx->threshold * 255.0f * channels;
+    for (int x = 0; x < width; x++) {
+        float diff = 0;
+        for (int c = 0; c < channels; c++) {
+            diff += blur1_row[x * channels + c] - ctx->tau * blur2_row[x * channels + c];
+        }
+        dog_row[x] = diff >= limit ? 255 : 0;
+    }
+}
+
+// Hand each row of src blurred at sigma * sigma_scale to callback. Gaussians compose
+// (G(a) * G(b) = G(sqrt(a^2 + b^2))), so this second blur is derived from blur1 (src at sigma)
+// with a much narrower kernel. Its rows feed the difference directly and are never stored as a
+// full image.
+static void blur_dog_rows(const Image* src, const Image* blur1, int kernel_size, float sigma, float sigma_scale,
+                          BlurRowCallback callback, void* context) {
+    if (sigma_scale > 1.0f) {
+        float sigma_step = sigma * sqrtf(sigma_scale * sigma_scale - 1.0f);
+        int step_size = min_int(kernel_size, gaussian_kernel_size(sigma_step));
+        apply_gaussian_blur_rows(blur1, step_size, sigma_step, callback, context);
+    } else {
+        apply_gaussian_blur_rows(src, kernel_size, sigma * sigma_scale, callback, context);
+    }
+}
 
 Image apply_dog_edge_detection(const Image* src, int kernel_size, float sigma, float sigma_scale, float tau, float threshold) {
     // Apply first Gaussian blur
     Image blur1 = apply_gaussian_blur(src, kernel_size, sigma);
     
-    // Apply second Gaussian blur
-    Image blur2 = apply_gaussian_blur(src, kernel_size, sigma * sigma_scale);
-    
     // Create output image
     Image dog = create_image(src->width, src->height, 1);  // Single channel for edge detection
-    
-    // Compute Difference of Gaussians
-    for (int y = 0; y < src->height; y++) {
-        for (int x = 0; x < src->width; x++) {
-            float diff = 0;
-            for (int c = 0; c < src->channels; c++) {
-                diff += get_pixel(&blur1, x, y, c) - tau * get_pixel(&blur2, x, y, c);
-            }
-            diff /= src->channels;
-            set_pixel(&dog, x, y, 0, diff >= threshold ? 1.0f : 0.0f);
-        }
-    }
+    DoGContext context = { &blur1, &dog, tau, threshold };
+    blur_dog_rows(src, &blur1, kernel_size, sigma, sigma_scale, dog_threshold_row, &context);
     
     // Clean up
     free_image(&blur1);
-    free_image(&blur2);
     
     return dog;
 }
 
-EdgeInfo apply_sobel_edge_detection(const Image* src) {
-    EdgeInfo edge_info;
-    edge_info.magnitude = create_image(src->width, src->height, 1);
-    edge_info.direction = create_image(src->width, src->height, 1);
-    
-    float kernel_x[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
-    float kernel_y[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
-    
-    for (int y = 1; y < src->height - 1; y++) {
-        for (int x = 1; x < src->width - 1; x++) {
-            float gx = 0, gy = 0;
-            for (int i = -1; i <= 1; i++) {
-                for (int j = -1; j <= 1; j++) {
-                    float pixel = get_pixel(src, x + j, y + i, 0);  // Assume grayscale
-                    gx += pixel * kernel_x[i+1][j+1];
-                    gy += pixel * kernel_y[i+1][j+1];
+// State shared with the soft threshold step of the XDoG surround blur
+typedef struct {
+    const Image* blurred;
+    ToneField* tone;
+    const XDoGOptions* options;
+} XDoGContext;
+
+// Pixels of one row handled together: their sharpened values are gathered first, then toned as
+// whole vectors
+#define XDOG_CHUNK 64
+
+// tanh comes from the Pade approximant x (27 + x^2) / (27 + 9 x^2), which is within 2% of it on
+// [-3, 0] and reaches exactly -1 at -3, where the argument is clamped
+void soft_threshold_tone(const float* sharpened, int count, float epsilon, float phi, uint16_t* dst) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256 zero = _mm256_setzero_ps(), low = _mm256_set1_ps(-3.0f);
+    const __m256 c27 = _mm256_set1_ps(27.0f), c9 = _mm256_set1_ps(9.0f), one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps((float)XDOG_WHITE), half = _mm256_set1_ps(0.5f);
+    const __m256 eps = _mm256_set1_ps(epsilon), slope = _mm256_set1_ps(phi);
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_mul_ps(slope, _mm256_sub_ps(_mm256_loadu_ps(sharpened + i), eps));
+        x = _mm256_max_ps(_mm256_min_ps(x, zero), low);
+        __m256 x2 = _mm256_mul_ps(x, x);
+        __m256 t = _mm256_div_ps(_mm256_mul_ps(x, _mm256_add_ps(c27, x2)), _mm256_add_ps(c27, _mm256_mul_ps(c9, x2)));
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(one, t), scale), half);
+        // Values are in [0.5, 65535.5], so the truncating conversion rounds; pack to 16 bits by lane
+        __m256i n = _mm256_cvttps_epi32(v);
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1));
+        _mm_storeu_si128((__m128i*)(dst + i), packed);
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps(), low = _mm_set1_ps(-3.0f);
+    const __m128 c27 = _mm_set1_ps(27.0f), c9 = _mm_set1_ps(9.0f), one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps((float)XDOG_WHITE), half = _mm_set1_ps(0.5f);
+    const __m128 eps = _mm_set1_ps(epsilon), slope = _mm_set1_ps(phi);
+    const __m128i bias = _mm_set1_epi32(32768);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_mul_ps(slope, _mm_sub_ps(_mm_loadu_ps(sharpened + i), eps));
+        x = _mm_max_ps(_mm_min_ps(x, zero), low);
+        __m128 x2 = _mm_mul_ps(x, x);
+        __m128 t = _mm_div_ps(_mm_mul_ps(x, _mm_add_ps(c27, x2)), _mm_add_ps(c27, _mm_mul_ps(c9, x2)));
+        __m128 v = _mm_add_ps(_mm_mul_ps(_mm_add_ps(one, t), scale), half);
+        // SSE2 only packs signed 16-bit, so shift to [-32768, 32767] around the pack and back
+        __m128i n = _mm_sub_epi32(_mm_cvttps_epi32(v), bias);
+        __m128i packed = _mm_add_epi16(_mm_packs_epi32(n, n), _mm_set1_epi16((short)0x8000));
+        _mm_storel_epi64((__m128i*)(dst + i), packed);
+    }
+#endif
+
+    // Scalar fallback and tail; same operations in the same order as the vector paths
+    for (; i < count; i++) {
+        float x = phi * (sharpened[i] - epsilon);
+        x = x < 0.0f ? x : 0.0f;
+        x = x > -3.0f ? x : -3.0f;
+        float x2 = x * x;
+        float t = (x * (27.0f + x2)) / (27.0f + 9.0f * x2);
+        dst[i] = (uint16_t)((1.0f + t) * (float)XDOG_WHITE + 0.5f);
+    }
+}
+
+void get_xdog_surround_blur(int kernel_size, float sigma, const XDoGOptions* options, int* surround_kernel_size,
+                            float* surround_sigma) {
+    // Gaussians compose (G(a) * G(b) = G(sqrt(a^2 + b^2))), so the surround is a narrow blur of G(sigma)
+    *surround_sigma = sigma * sqrtf(options->sigma_scale * options->sigma_scale - 1.0f);
+    *surround_kernel_size = min_int(kernel_size, gaussian_kernel_size(*surround_sigma));
+}
+
+void xdog_tone_pixels(const uint8_t* blur1, const uint8_t* blur2, int count, int channels, const XDoGOptions* options,
+                      uint16_t* dst) {
+    // Sharpened luma (1 + p) G1 - p G2 with p = tau / (1 - tau), in [0, 1] units; flat areas keep
+    // their luma and edges overshoot on both sides
+    float gain = 1.0f / (255.0f * (1.0f - options->tau));
+    float sharpened[XDOG_CHUNK];
+    for (int x0 = 0; x0 < count; x0 += XDOG_CHUNK) {
+        int chunk = min_int(XDOG_CHUNK, count - x0);
+        for (int i = 0; i < chunk; i++) {
+            const uint8_t* a = blur1 + (size_t)(x0 + i) * channels;
+            const uint8_t* b = blur2 + (size_t)(x0 + i) * channels;
+            float g1 = a[0], g2 = b[0];
+            if (channels >= 3) {
+                // Rec. 709 luma, with the weights of convert_row_to_luma
+                g1 = (54.0f * a[0] + 183.0f * a[1] + 19.0f * a[2]) / 256.0f;
+                g2 = (54.0f * b[0] + 183.0f * b[1] + 19.0f * b[2]) / 256.0f;
+            }
+            sharpened[i] = (g1 - options->tau * g2) * gain;
+        }
+        soft_threshold_tone(sharpened, chunk, options->epsilon, options->phi, dst + x0);
+    }
+}
+
+// Called with each row of the surround blur as its vertical pass finishes it
+static void xdog_tone_row(int y, const uint8_t* surround_row, void* context) {
+    XDoGContext* ctx = (XDoGContext*)context;
+    int width = ctx->blurred->width;
+    int channels = ctx->blurred->channels;
+    xdog_tone_pixels(ctx->blurred->data + (size_t)y * width * channels, surround_row, width, channels, ctx->options,
+                     ctx->tone->data + (size_t)y * width);
+}
+
+ToneField apply_xdog(const Image* blurred, int kernel_size, float sigma, const XDoGOptions* options) {
+    ToneField tone;
+    tone.width = blurred->width;
+    tone.height = blurred->height;
+    tone.data = (uint16_t*)safe_malloc((size_t)blurred->width * blurred->height * sizeof(uint16_t));
+
+    int surround_kernel_size;
+    float surround_sigma;
+    get_xdog_surround_blur(kernel_size, sigma, options, &surround_kernel_size, &surround_sigma);
+    XDoGContext context = { blurred, &tone, options };
+    apply_gaussian_blur_rows(blurred, surround_kernel_size, surround_sigma, xdog_tone_row, &context);
+    return tone;
+}
+
+void free_tone_field(ToneField* tone) {
+    free(tone->data);
+    tone->data = NULL;
+}
+
+static void luma_row(const Image* src, int y, uint8_t* dst) {
+    convert_row_to_luma(src->data + (size_t)y * src->width * src->channels, src->channels, src->width, dst);
+}
+
+// Map a gradient to the EDGE_CHARS bin of the edge running across it, using slope tests
+// against tan(22.5 deg) ~= 53/128 instead of atan2. The image y axis points down.
+static int classify_edge_direction(int gx, int gy) {
+    int ax = abs(gx), ay = abs(gy);
+
+    if (ay * 128 <= ax * 53) {
+        return EDGE_VERTICAL;
+    }
+    if (ax * 128 <= ay * 53) {
+        return EDGE_HORIZONTAL;
+    }
+    return (gx ^ gy) < 0 ? EDGE_DIAGONAL_DOWN : EDGE_DIAGONAL_UP;
+}
+
+// Magnitudes are compared squared, in 0-255 units
+static int sobel_limit_squared(float threshold) {
+    int limit = (int)(threshold * 255.0f);
+    return limit * limit;
+}
+
+// EDGE_CHARS direction of the luma pixel center[x], or -1 when it is not an edge
+static inline int sobel_direction(const uint8_t* above, const uint8_t* center, const uint8_t* below, int x, int limit_squared) {
+    int gx = (above[x + 1] + 2 * center[x + 1] + below[x + 1]) - (above[x - 1] + 2 * center[x - 1] + below[x - 1]);
+    int gy = (below[x - 1] + 2 * below[x] + below[x + 1]) - (above[x - 1] + 2 * above[x] + above[x + 1]);
+    if (gx * gx + gy * gy >= limit_squared && (gx | gy) != 0) {
+        return classify_edge_direction(gx, gy);
+    }
+    return -1;
+}
+
+void vote_sobel_row(const uint8_t* above, const uint8_t* center, const uint8_t* below, int x0, int x1,
+                    float threshold, uint32_t* votes) {
+    int limit_squared = sobel_limit_squared(threshold);
+    for (int x = x0; x < x1; x++) {
+        int direction = sobel_direction(above, center, below, x, limit_squared);
+        if (direction >= 0) {
+            votes[direction]++;
+        }
+    }
+}
+
+uint8_t vote_cell_edge(const uint32_t* votes, int pixels, float coverage) {
+    uint32_t total = 0;
+    int winner = 0;
+    for (int direction = 0; direction < EDGE_DIRECTIONS; direction++) {
+        total += votes[direction];
+        if (votes[direction] > votes[winner]) {
+            winner = direction;
+        }
+    }
+
+    if (total == 0 || total < coverage * pixels) {
+        return 0;
+    }
+    return (uint8_t)(EDGE_PIXEL_FLAG | winner);
+}
+
+// Source and result of detect_cell_edges, split into bands of cell rows
+typedef struct {
+    const Image* src;
+    Image* cells;
+    float threshold;
+    float coverage;
+} CellEdgeJob;
+
+static void cell_edge_band(int begin, int end, void* context) {
+    const CellEdgeJob* job = (const CellEdgeJob*)context;
+    const Image* src = job->src;
+    Image* cells = job->cells;
+    int width = src->width;
+
+    // Three luma rows and the votes of one row of cells; a band walks its pixel rows once, top to
+    // bottom, so each source row is converted once plus the halo row above the band
+    uint8_t* window = (uint8_t*)safe_malloc((size_t)width * 3);
+    uint32_t* votes = (uint32_t*)safe_malloc((size_t)cells->width * EDGE_DIRECTIONS * sizeof(uint32_t));
+    int* cell_x0 = (int*)safe_malloc((size_t)cells->width * 2 * sizeof(int));
+    int* cell_x1 = cell_x0 + cells->width;
+    for (int cx = 0; cx < cells->width; cx++) {
+        get_cell_bounds(width, cells->width, cx, &cell_x0[cx], &cell_x1[cx]);
+        // Border pixels are never edges
+        cell_x0[cx] = max_int(cell_x0[cx], 1);
+        cell_x1[cx] = min_int(cell_x1[cx], width - 1);
+    }
+
+    int loaded = -1;  // Last luma row in the window
+    for (int cy = begin; cy < end; cy++) {
+        int y0, y1;
+        get_cell_bounds(src->height, cells->height, cy, &y0, &y1);
+        memset(votes, 0, (size_t)cells->width * EDGE_DIRECTIONS * sizeof(uint32_t));
+
+        // Centers run over the interior rows of the cell; the two rows above the first one are
+        // still in the window when the cell row above was just done
+        int first = max_int(y0, 1);
+        int last = min_int(y1, src->height - 1);
+        for (int y = max_int(first - 1, loaded + 1); y <= first && first < last; y++) {
+            luma_row(src, y, window + (size_t)(y % 3) * width);
+            loaded = y;
+        }
+        for (int y = first; y < last; y++) {
+            const uint8_t* above = window + (size_t)((y - 1) % 3) * width;
+            const uint8_t* center = window + (size_t)(y % 3) * width;
+            uint8_t* below = window + (size_t)((y + 1) % 3) * width;
+            luma_row(src, y + 1, below);
+            loaded = y + 1;
+
+            for (int cx = 0; cx < cells->width; cx++) {
+                vote_sobel_row(above, center, below, cell_x0[cx], cell_x1[cx], job->threshold,
+                               votes + (size_t)cx * EDGE_DIRECTIONS);
+            }
+        }
+
+        uint8_t* dst = cells->data + (size_t)cy * cells->width;
+        for (int cx = 0; cx < cells->width; cx++) {
+            int x0, x1;
+            get_cell_bounds(width, cells->width, cx, &x0, &x1);
+            dst[cx] = vote_cell_edge(votes + (size_t)cx * EDGE_DIRECTIONS, (x1 - x0) * (y1 - y0), job->coverage);
+        }
+    }
+
+    free(cell_x0);
+    free(votes);
+    free(window);
+}
+
+Image detect_cell_edges(const Image* src, float threshold, float coverage, int cells_wide, int cells_high) {
+    Image cells = create_image(cells_wide, cells_high, 1);
+    memset(cells.data, 0, (size_t)cells_wide * cells_high);
+    if (src->width < 3 || src->height < 3) {
+        return cells;
+    }
+
+    CellEdgeJob job = { src, &cells, threshold, coverage };
+    parallel_for(cells_high, EDGE_MIN_BAND_CELL_ROWS, cell_edge_band, &job);
+
+    return cells;
+}
+
+// Edge image and cell result of vote_cell_edges, split into bands of cell rows
+typedef struct {
+    const Image* edges;
+    Image* cells;
+    float coverage;
+} CellVoteJob;
+
+static void cell_vote_band(int begin, int end, void* context) {
+    const CellVoteJob* job = (const CellVoteJob*)context;
+    const Image* edges = job->edges;
+    int cells_wide = job->cells->width;
+    uint32_t* votes = (uint32_t*)safe_malloc((size_t)cells_wide * EDGE_DIRECTIONS * sizeof(uint32_t));
+
+    for (int cy = begin; cy < end; cy++) {
+        int y0, y1;
+        get_cell_bounds(edges->height, job->cells->height, cy, &y0, &y1);
+        memset(votes, 0, (size_t)cells_wide * EDGE_DIRECTIONS * sizeof(uint32_t));
+
+        for (int y = y0; y < y1; y++) {
+            const uint8_t* row = edges->data + (size_t)y * edges->width;
+            for (int cx = 0; cx < cells_wide; cx++) {
+                int x0, x1;
+                get_cell_bounds(edges->width, cells_wide, cx, &x0, &x1);
+                for (int x = x0; x < x1; x++) {
+                    if (row[x] & EDGE_PIXEL_FLAG) {
+                        votes[cx * EDGE_DIRECTIONS + (row[x] & EDGE_DIRECTION_MASK)]++;
+                    }
                 }
             }
-            float magnitude = sqrt(gx*gx + gy*gy);
-            float direction = atan2(gy, gx);
-            
-            set_pixel(&edge_info.magnitude, x, y, 0, magnitude);
-            set_pixel(&edge_info.direction, x, y, 0, direction);
+        }
+
+        for (int cx = 0; cx < cells_wide; cx++) {
+            int x0, x1;
+            get_cell_bounds(edges->width, cells_wide, cx, &x0, &x1);
+            int length = max_int(x1 - x0, y1 - y0);
+            job->cells->data[(size_t)cy * cells_wide + cx] = vote_cell_edge(votes + cx * EDGE_DIRECTIONS, length, job->coverage);
         }
     }
-    
-    return edge_info;
+
+    free(votes);
 }
 
-Image quantize_edge_direction(const Image* direction) {
-    Image quantized = create_image(direction->width, direction->height, 1);
-    
-    for (int y = 0; y < direction->height; y++) {
-        for (int x = 0; x < direction->width; x++) {
-            float angle = get_pixel(direction, x, y, 0);
-            float abs_angle = fabs(angle) / PI;
-            int value;
-            
-            if ((abs_angle >= 0.0 && abs_angle < 0.05) || (abs_angle > 0.95 && abs_angle <= 1.0)) {
-                value = 0;  // Vertical
-            } else if (abs_angle > 0.45 && abs_angle < 0.55) {
-                value = 1;  // Horizontal
-            } else if ((abs_angle > 0.05 && abs_angle < 0.45 && angle > 0) ||
-                       (abs_angle > 0.55 && abs_angle < 0.95 && angle < 0)) {
-                value = 2;  // Diagonal 1
-            } else {
-                value = 3;  // Diagonal 2
+Image vote_cell_edges(const Image* edges, float coverage, int cells_wide, int cells_high) {
+    Image cells = create_image(cells_wide, cells_high, 1);
+    CellVoteJob job = { edges, &cells, coverage };
+    parallel_for(cells_high, EDGE_MIN_BAND_CELL_ROWS, cell_vote_band, &job);
+    return cells;
+}
+
+// Rows of one band of the Canny link pass. Components are first joined inside each band in
+// parallel, then across the band seams on one thread; the seams are only a row per band.
+#define CANNY_BAND_ROWS 64
+
+// Per-pixel state of detect_canny_edges: the EDGE_CHARS direction in the low bits, plus whether
+// the pixel survived non-maximum suppression above the low (weak) or high (strong) threshold.
+// On the root of a component, CANNY_STRONG means some pixel of the component is strong.
+#define CANNY_WEAK 0x10
+#define CANNY_STRONG 0x20
+#define CANNY_CANDIDATE (CANNY_WEAK | CANNY_STRONG)
+
+// Gradient, state and union-find forest shared by the passes of detect_canny_edges
+typedef struct {
+    const Image* src;
+    int width;
+    int height;
+    uint16_t* magnitude;  // Rounded Sobel gradient magnitude, in 0-255 pixel units
+    uint8_t* state;
+    uint32_t* parent;     // Union-find parent of each candidate; roots point to themselves
+    int low;
+    int high;
+    Image* edges;
+} CannyJob;
+
+// Sobel magnitude and direction of interior rows, from a rolling window of luma rows
+static void canny_gradient_band(int begin, int end, void* context) {
+    const CannyJob* job = (const CannyJob*)context;
+    int width = job->width;
+
+    uint8_t* window = (uint8_t*)safe_malloc((size_t)width * 3);
+    luma_row(job->src, begin - 1, window + (size_t)((begin - 1) % 3) * width);
+    luma_row(job->src, begin, window + (size_t)(begin % 3) * width);
+
+    for (int y = begin; y < end; y++) {
+        const uint8_t* above = window + (size_t)((y - 1) % 3) * width;
+        const uint8_t* center = window + (size_t)(y % 3) * width;
+        uint8_t* below = window + (size_t)((y + 1) % 3) * width;
+        luma_row(job->src, y + 1, below);
+
+        uint16_t* magnitude = job->magnitude + (size_t)y * width;
+        uint8_t* state = job->state + (size_t)y * width;
+        for (int x = 1; x < width - 1; x++) {
+            int gx = (above[x + 1] + 2 * center[x + 1] + below[x + 1]) - (above[x - 1] + 2 * center[x - 1] + below[x - 1]);
+            int gy = (below[x - 1] + 2 * below[x] + below[x + 1]) - (above[x - 1] + 2 * above[x] + above[x + 1]);
+            magnitude[x] = (uint16_t)(sqrtf((float)(gx * gx + gy * gy)) + 0.5f);
+            state[x] = (gx | gy) != 0 ? (uint8_t)classify_edge_direction(gx, gy) : 0;
+        }
+    }
+
+    free(window);
+}
+
+static void canny_gradient_interior_band(int begin, int end, void* context) {
+    canny_gradient_band(begin + 1, end + 1, context);
+}
+
+static uint32_t canny_find(uint32_t* parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];  // Path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+// The lower index becomes the root, so inside a band every root stays in the band
+static void canny_union(const CannyJob* job, uint32_t a, uint32_t b) {
+    a = canny_find(job->parent, a);
+    b = canny_find(job->parent, b);
+    if (a == b) {
+        return;
+    }
+    if (a > b) {
+        uint32_t swap = a;
+        a = b;
+        b = swap;
+    }
+    job->parent[b] = a;
+    job->state[a] |= job->state[b] & CANNY_STRONG;
+}
+
+// Offset of the neighbour across the edge (along the gradient) for each EDGE_CHARS direction
+static ptrdiff_t canny_across(int direction, int width) {
+    switch (direction) {
+    case EDGE_VERTICAL:
+        return 1;
+    case EDGE_HORIZONTAL:
+        return width;
+    case EDGE_DIAGONAL_DOWN:
+        return 1 - (ptrdiff_t)width;
+    default:
+        return 1 + (ptrdiff_t)width;
+    }
+}
+
+// Non-maximum suppression and double threshold of one band of rows, linking each candidate to the
+// candidates before it (left, and the three above while still inside the band)
+static void canny_link_rows(const CannyJob* job, int band) {
+    int width = job->width;
+    int band_top = band * CANNY_BAND_ROWS;
+    int y0 = max_int(band_top, 1);
+    int y1 = min_int(band_top + CANNY_BAND_ROWS, job->height - 1);
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 1; x < width - 1; x++) {
+            uint32_t i = (uint32_t)y * width + x;
+            int m = job->magnitude[i];
+            if (m < job->low) {
+                continue;
+            }
+
+            ptrdiff_t across = canny_across(job->state[i] & EDGE_DIRECTION_MASK, width);
+            // Strictly above one side so a plateau two pixels wide keeps only one of them
+            if (m <= job->magnitude[i - across] || m < job->magnitude[i + across]) {
+                continue;
+            }
+
+            job->state[i] |= m >= job->high ? CANNY_STRONG : CANNY_WEAK;
+            job->parent[i] = i;
+            if (job->state[i - 1] & CANNY_CANDIDATE) {
+                canny_union(job, i, i - 1);
+            }
+            if (y > band_top) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (job->state[i - width + dx] & CANNY_CANDIDATE) {
+                        canny_union(job, i, i - width + dx);
+                    }
+                }
             }
-            
-            set_pixel(&quantized, x, y, 0, value / 3.0f);  // Normalize to [0, 1]
         }
     }
-    
-    return quantized;
 }
 
-void free_edge_info(EdgeInfo* edge_info) {
-    free_image(&edge_info->magnitude);
-    free_image(&edge_info->direction);
-}
\ No newline at end of file
+static void canny_link_band(int begin, int end, void* context) {
+    for (int band = begin; band < end; band++) {
+        canny_link_rows((const CannyJob*)context, band);
+    }
+}
+
+// Keep the candidates whose component holds a strong pixel. Nothing writes the forest any more,
+// so roots are found without compressing paths.
+static void canny_output_band(int begin, int end, void* context) {
+    const CannyJob* job = (const CannyJob*)context;
+    int width = job->width;
+
+    for (int y = begin; y < end; y++) {
+        uint8_t* dst = job->edges->data + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            uint32_t i = (uint32_t)y * width + x;
+            uint8_t state = job->state[i];
+            if (!(state & CANNY_CANDIDATE)) {
+                dst[x] = 0;
+                continue;
+            }
+            uint32_t root = i;
+            while (job->parent[root] != root) {
+                root = job->parent[root];
+            }
+            dst[x] = (job->state[root] & CANNY_STRONG) ? (uint8_t)(EDGE_PIXEL_FLAG | (state & EDGE_DIRECTION_MASK)) : 0;
+        }
+    }
+}
+
+Image detect_canny_edges(const Image* src, float low_threshold, float high_threshold) {
+    Image edges = create_image(src->width, src->height, 1);
+    if (src->width < 3 || src->height < 3) {
+        memset(edges.data, 0, (size_t)src->width * src->height);
+        return edges;
+    }
+    size_t pixels = (size_t)src->width * src->height;
+    if (pixels >= UINT32_MAX) {
+        error_exit("Image too large for Canny edge detection: %dx%d", src->width, src->height);
+    }
+
+    CannyJob job;
+    job.src = src;
+    job.width = src->width;
+    job.height = src->height;
+    job.magnitude = (uint16_t*)safe_calloc(pixels, sizeof(uint16_t));
+    job.state = (uint8_t*)safe_calloc(pixels, 1);
+    job.parent = (uint32_t*)safe_malloc(pixels * sizeof(uint32_t));
+    job.low = (int)(low_threshold * 255.0f);
+    job.high = (int)(high_threshold * 255.0f);
+    job.edges = &edges;
+
+    parallel_for(src->height - 2, EDGE_MIN_BAND_ROWS, canny_gradient_interior_band, &job);
+
+    int bands = (src->height + CANNY_BAND_ROWS - 1) / CANNY_BAND_ROWS;
+    parallel_for(bands, 1, canny_link_band, &job);
+
+    // Join the components that meet across each seam: the first row of a band and the row above it
+    for (int band = 1; band < bands; band++) {
+        int y = band * CANNY_BAND_ROWS;
+        if (y >= src->height - 1) {
+            break;
+        }
+        for (int x = 1; x < src->width - 1; x++) {
+            uint32_t i = (uint32_t)y * src->width + x;
+            if (!(job.state[i] & CANNY_CANDIDATE)) {
+                continue;
+            }
+            for (int dx = -1; dx <= 1; dx++) {
+                if (job.state[i - src->width + dx] & CANNY_CANDIDATE) {
+                    canny_union(&job, i, i - src->width + dx);
+                }
+            }
+        }
+    }
+
+    parallel_for(src->height, EDGE_MIN_BAND_ROWS, canny_output_band, &job);
+
+    free(job.magnitude);
+    free(job.state);
+    free(job.parent);
+    return edges;
+}
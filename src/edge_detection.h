@@ -3,24 +3,90 @@
 #ifndef EDGE_DETECTION_H
 #define EDGE_DETECTION_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "image_loader.h"
 
-// Structure to hold edge detection results
+// Packed edge byte produced by the edge detectors: EDGE_PIXEL_FLAG marks an
+// edge and the low bits hold the EDGE_CHARS index ("|-\\/") of the edge's direction
+#define EDGE_PIXEL_FLAG 0x80
+#define EDGE_DIRECTION_MASK 0x03
+#define EDGE_DIRECTIONS 4
+
+enum {
+    EDGE_VERTICAL = 0,
+    EDGE_HORIZONTAL = 1,
+    EDGE_DIAGONAL_DOWN = 2,  // Runs from top-left to bottom-right
+    EDGE_DIAGONAL_UP = 3     // Runs from bottom-left to top-right
+};
+
+// Per-pixel tone from apply_xdog, from 0 (black) to XDOG_WHITE
+#define XDOG_WHITE 65535
 typedef struct {
-    Image magnitude;
-    Image direction;
-} EdgeInfo;
+    int width;
+    int height;
+    uint16_t* data;
+} ToneField;
 
 // Apply Difference of Gaussians (DoG) edge detection
 Image apply_dog_edge_detection(const Image* src, int kernel_size, float sigma, float sigma_scale, float tau, float threshold);
 
-// Apply Sobel edge detection
-EdgeInfo apply_sobel_edge_detection(const Image* src);
+// Parameters of the extended DoG (Winnemoller's XDoG) on top of the blur G(sigma) it sharpens;
+// values are in [0, 1] luma units
+typedef struct {
+    float sigma_scale;  // Surround Gaussian at sigma times this (above 1)
+    float tau;          // Weight of the surround, sharpening by p = tau / (1 - tau)
+    float epsilon;      // Sharpened luma at and above which the tone stays white
+    float phi;          // Slope of the darkening below epsilon; large for ink lines, small for shading
+} XDoGOptions;
+
+// Kernel and sigma of the narrow blur that takes G(sigma) (a kernel_size FIR) to the surround
+// G(sigma * sigma_scale); the surround kernel is never wider than kernel_size
+void get_xdog_surround_blur(int kernel_size, float sigma, const XDoGOptions* options, int* surround_kernel_size,
+                            float* surround_sigma);
+
+// XDoG tone of `count` pixels (`channels` bytes each) from their G(sigma) and surround blurs: the
+// luma is sharpened as (1 + p) G(sigma) - p G(sigma * sigma_scale), then soft_threshold_tone keeps
+// values above epsilon white and darkens those below it
+void xdog_tone_pixels(const uint8_t* blur1, const uint8_t* blur2, int count, int channels, const XDoGOptions* options,
+                      uint16_t* dst);
+
+// XDoG tone field of an image already blurred at sigma with kernel_size. Only the surround is
+// blurred here, from `blurred` itself, and each row is toned as that blur finishes it.
+ToneField apply_xdog(const Image* blurred, int kernel_size, float sigma, const XDoGOptions* options);
+
+// XDoG soft threshold of `count` values: 1 + tanh(phi * min(s - epsilon, 0)), scaled to
+// XDOG_WHITE, with a fast vectorized tanh. Results are identical on every instruction set.
+void soft_threshold_tone(const float* values, int count, float epsilon, float phi, uint16_t* dst);
+
+// Free ToneField data
+void free_tone_field(ToneField* tone);
+
+// One packed edge byte per cell of a cells_wide x cells_high grid (cells as get_cell_bounds splits
+// the image). Every pixel of a cell votes with its Sobel direction, as in vote_sobel_row, and the
+// cell becomes an edge, in the most voted direction, when edge pixels cover at least `coverage` of it.
+Image detect_cell_edges(const Image* src, float threshold, float coverage, int cells_wide, int cells_high);
+
+// Canny edges: Sobel gradients thinned by non-maximum suppression, then hysteresis keeps the pixels
+// above low_threshold that are connected to one above high_threshold. Thresholds are in the units of
+// vote_sobel_row, and lines are one pixel wide. Hysteresis links pixels
+// with a union-find forest built per band of rows in parallel and joined at the band seams.
+Image detect_canny_edges(const Image* src, float low_threshold, float high_threshold);
+
+// One packed edge byte per cell from one-pixel-wide edge lines (detect_canny_edges), voted as in
+// detect_cell_edges except that coverage is measured against the cell's longer side rather than its
+// area: the lines in a cell must add up to that share of its length, at any cell size.
+Image vote_cell_edges(const Image* edges, float coverage, int cells_wide, int cells_high);
 
-// Quantize edge directions
-Image quantize_edge_direction(const Image* direction);
+// Add the direction of each edge pixel in [x0, x1) of the luma row `center` to votes
+// (EDGE_DIRECTIONS counters): a pixel is an edge when its Sobel gradient magnitude, with pixels in
+// [0, 1], reaches threshold, and votes for the direction of the edge running across the gradient.
+// The neighbours of every pixel in the range must be readable.
+void vote_sobel_row(const uint8_t* above, const uint8_t* center, const uint8_t* below, int x0, int x1,
+                    float threshold, uint32_t* votes);
 
-// Free EdgeInfo structure
-void free_edge_info(EdgeInfo* edge_info);
+// Packed edge byte of a cell of `pixels` pixels from its votes: the most voted direction (the
+// first one on ties), or 0 when edge pixels cover less than `coverage` of the cell
+uint8_t vote_cell_edge(const uint32_t* votes, int pixels, float coverage);
 
 #endif // EDGE_DETECTION_H
\ No newline at end of file
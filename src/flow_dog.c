@@ -0,0 +1,336 @@
+// flow_dog.c
+
+#include "flow_dog.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Smallest number of rows handed to a thread by the row passes
+#define FLOW_MIN_BAND_ROWS 16
+
+// Side of the square tiles of the two flow passes. Their samples stay within a few pixels of the
+// pixel being filtered, so the fields under a tile and its margin stay in cache while it is done.
+#define FLOW_TILE_SIZE 64
+
+// Largest tensor eigenvalue below which a pixel has no usable gradient and gets no tangent
+#define FLOW_MIN_EIGENVALUE 1e-6f
+
+// One side of a symmetric kernel: weights[0] is the center, weights[i] the taps at -i and +i
+typedef struct {
+    int radius;
+    float* weights;
+} SymmetricTaps;
+
+// Gaussian taps out to 3 sigma, normalized so the whole kernel sums to 1
+static SymmetricTaps make_gaussian_taps(float sigma) {
+    SymmetricTaps taps;
+    taps.radius = max_int(1, (int)ceilf(3.0f * sigma));
+    taps.weights = (float*)safe_malloc((size_t)(taps.radius + 1) * sizeof(float));
+
+    float sum = 0.0f;
+    for (int i = 0; i <= taps.radius; i++) {
+        taps.weights[i] = expf(-(float)(i * i) / (2.0f * sigma * sigma));
+        sum += i == 0 ? taps.weights[i] : 2.0f * taps.weights[i];
+    }
+    for (int i = 0; i <= taps.radius; i++) {
+        taps.weights[i] /= sum;
+    }
+    return taps;
+}
+
+// Fields and kernels shared by the passes of apply_flow_dog
+typedef struct {
+    const Image* src;
+    const FlowDoGOptions* options;
+    int width;
+    int height;
+    int tiles_across;
+    SymmetricTaps tensor_taps;
+    SymmetricTaps dog_taps;   // Center Gaussian minus tau times the surround Gaussian
+    SymmetricTaps flow_taps;
+    float* luma;              // Source luma in [0, 1]
+    float* tensor;            // Structure tensor (E, F, G) of each pixel, blurred along its row
+    float* tangent;           // Unit edge tangent (x, y) of each pixel, zero where there is none
+    float* response;          // DoG across the flow
+    ToneField* tone;
+} FlowJob;
+
+static void luma_band(int begin, int end, void* context) {
+    const FlowJob* job = (const FlowJob*)context;
+    const Image* src = job->src;
+    uint8_t* row = (uint8_t*)safe_malloc(job->width);
+
+    for (int y = begin; y < end; y++) {
+        convert_row_to_luma(src->data + (size_t)y * job->width * src->channels, src->channels, job->width, row);
+        float* dst = job->luma + (size_t)y * job->width;
+        for (int x = 0; x < job->width; x++) {
+            dst[x] = row[x] / 255.0f;
+        }
+    }
+
+    free(row);
+}
+
+// Sobel gradients of each row turned into tensor entries (gx^2, gx gy, gy^2), then the horizontal
+// half of the tensor blur. Borders are replicated.
+static void tensor_rows_band(int begin, int end, void* context) {
+    const FlowJob* job = (const FlowJob*)context;
+    int width = job->width;
+    int radius = job->tensor_taps.radius;
+    const float* weights = job->tensor_taps.weights;
+
+    // One row of tensor entries with `radius` replicated entries on either side
+    float* padded = (float*)safe_malloc((size_t)(width + 2 * radius) * 3 * sizeof(float));
+    float* row = padded + (size_t)radius * 3;
+
+    for (int y = begin; y < end; y++) {
+        const float* above = job->luma + (size_t)max_int(y - 1, 0) * width;
+        const float* center = job->luma + (size_t)y * width;
+        const float* below = job->luma + (size_t)min_int(y + 1, job->height - 1) * width;
+
+        for (int x = 0; x < width; x++) {
+            int left = max_int(x - 1, 0), right = min_int(x + 1, width - 1);
+            float gx = (above[right] + 2.0f * center[right] + below[right]) - (above[left] + 2.0f * center[left] + below[left]);
+            float gy = (below[left] + 2.0f * below[x] + below[right]) - (above[left] + 2.0f * above[x] + above[right]);
+            row[3 * x] = gx * gx;
+            row[3 * x + 1] = gx * gy;
+            row[3 * x + 2] = gy * gy;
+        }
+        for (int i = 1; i <= radius; i++) {
+            memcpy(row - 3 * i, row, 3 * sizeof(float));
+            memcpy(row + 3 * (width - 1 + i), row + 3 * (width - 1), 3 * sizeof(float));
+        }
+
+        float* dst = job->tensor + (size_t)y * width * 3;
+        for (int i = 0; i < 3 * width; i++) {
+            float sum = weights[0] * row[i];
+            for (int k = 1; k <= radius; k++) {
+                sum += weights[k] * (row[i - 3 * k] + row[i + 3 * k]);
+            }
+            dst[i] = sum;
+        }
+    }
+
+    free(padded);
+}
+
+// Vertical half of the tensor blur, then the tangent: the eigenvector of the smaller eigenvalue,
+// i.e. the major eigenvector (the dominant gradient direction) turned by 90 degrees
+static void tangent_band(int begin, int end, void* context) {
+    const FlowJob* job = (const FlowJob*)context;
+    int width = job->width;
+    int radius = job->tensor_taps.radius;
+    const float* weights = job->tensor_taps.weights;
+    size_t stride = (size_t)width * 3;
+    float* sum = (float*)safe_malloc(stride * sizeof(float));
+
+    for (int y = begin; y < end; y++) {
+        const float* center = job->tensor + (size_t)y * stride;
+        for (size_t i = 0; i < stride; i++) {
+            sum[i] = weights[0] * center[i];
+        }
+        for (int k = 1; k <= radius; k++) {
+            const float* up = job->tensor + (size_t)max_int(y - k, 0) * stride;
+            const float* down = job->tensor + (size_t)min_int(y + k, job->height - 1) * stride;
+            for (size_t i = 0; i < stride; i++) {
+                sum[i] += weights[k] * (up[i] + down[i]);
+            }
+        }
+
+        float* tangent = job->tangent + (size_t)y * width * 2;
+        for (int x = 0; x < width; x++) {
+            float e = sum[3 * x], f = sum[3 * x + 1], g = sum[3 * x + 2];
+            float lambda = 0.5f * (e + g + sqrtf((e - g) * (e - g) + 4.0f * f * f));
+
+            // Both (lambda - g, f) and (f, lambda - e) are major eigenvectors; one of them vanishes
+            // for gradients along an axis, so take the longer
+            float ax = lambda - g, ay = f;
+            float bx = f, by = lambda - e;
+            if (bx * bx + by * by > ax * ax + ay * ay) {
+                ax = bx;
+                ay = by;
+            }
+            float length = sqrtf(ax * ax + ay * ay);
+            if (lambda < FLOW_MIN_EIGENVALUE || length == 0.0f) {
+                tangent[2 * x] = 0.0f;
+                tangent[2 * x + 1] = 0.0f;
+            } else {
+                tangent[2 * x] = -ay / length;
+                tangent[2 * x + 1] = ax / length;
+            }
+        }
+    }
+
+    free(sum);
+}
+
+// Bilinear sample of a one-channel field at a point with 0 <= x < width - 1 and 0 <= y < height - 1
+static inline float sample_inside(const float* field, int width, float x, float y) {
+    int x0 = (int)x, y0 = (int)y;
+    float fx = x - x0, fy = y - y0;
+
+    const float* top = field + (size_t)y0 * width + x0;
+    const float* bottom = top + width;
+    float upper = top[0] + fx * (top[1] - top[0]);
+    float lower = bottom[0] + fx * (bottom[1] - bottom[0]);
+    return upper + fy * (lower - upper);
+}
+
+// Bilinear sample of a one-channel field, clamped to its edges
+static float sample_field(const float* field, int width, int height, float x, float y) {
+    x = x < 0.0f ? 0.0f : (x > width - 1 ? (float)(width - 1) : x);
+    y = y < 0.0f ? 0.0f : (y > height - 1 ? (float)(height - 1) : y);
+    int x0 = (int)x, y0 = (int)y;
+    int x1 = min_int(x0 + 1, width - 1), y1 = min_int(y0 + 1, height - 1);
+    float fx = x - x0, fy = y - y0;
+
+    const float* top = field + (size_t)y0 * width;
+    const float* bottom = field + (size_t)y1 * width;
+    float upper = top[x0] + fx * (top[x1] - top[x0]);
+    float lower = bottom[x0] + fx * (bottom[x1] - bottom[x0]);
+    return upper + fy * (lower - upper);
+}
+
+// Pixel bounds of one FLOW_TILE_SIZE tile
+static void get_tile_bounds(const FlowJob* job, int tile, int* x0, int* y0, int* x1, int* y1) {
+    *x0 = (tile % job->tiles_across) * FLOW_TILE_SIZE;
+    *y0 = (tile / job->tiles_across) * FLOW_TILE_SIZE;
+    *x1 = min_int(*x0 + FLOW_TILE_SIZE, job->width);
+    *y1 = min_int(*y0 + FLOW_TILE_SIZE, job->height);
+}
+
+// 1D DoG of the luma along the gradient (across the flow) through each pixel of the tiles
+static void across_band(int begin, int end, void* context) {
+    const FlowJob* job = (const FlowJob*)context;
+    const float* weights = job->dog_taps.weights;
+    int radius = job->dog_taps.radius;
+
+    for (int tile = begin; tile < end; tile++) {
+        int x0, y0, x1, y1;
+        get_tile_bounds(job, tile, &x0, &y0, &x1, &y1);
+
+        for (int y = y0; y < y1; y++) {
+            // Taps stay within radius pixels of the center, so away from the borders nothing is clamped
+            bool inside_rows = y >= radius && y < job->height - 1 - radius;
+            for (int x = x0; x < x1; x++) {
+                size_t i = (size_t)y * job->width + x;
+                const float* t = job->tangent + 2 * i;
+                float nx = t[1], ny = -t[0];
+
+                float sum = weights[0] * job->luma[i];
+                if (inside_rows && x >= radius && x < job->width - 1 - radius) {
+                    for (int k = 1; k <= radius; k++) {
+                        sum += weights[k] * (sample_inside(job->luma, job->width, x + k * nx, y + k * ny) +
+                                             sample_inside(job->luma, job->width, x - k * nx, y - k * ny));
+                    }
+                } else {
+                    for (int k = 1; k <= radius; k++) {
+                        sum += weights[k] * (sample_field(job->luma, job->width, job->height, x + k * nx, y + k * ny) +
+                                             sample_field(job->luma, job->width, job->height, x - k * nx, y - k * ny));
+                    }
+                }
+                job->response[i] = sum;
+            }
+        }
+    }
+}
+
+// Line integral convolution of the DoG responses along the flow curve through (x, y): unit steps
+// forward and backward, each following the tangent where it lands
+static float integrate_flow(const FlowJob* job, int x, int y) {
+    const float* weights = job->flow_taps.weights;
+    size_t start = (size_t)y * job->width + x;
+    float sum = weights[0] * job->response[start];
+    float total = weights[0];
+
+    for (int side = -1; side <= 1; side += 2) {
+        float px = (float)x, py = (float)y;
+        float dx = side * job->tangent[2 * start], dy = side * job->tangent[2 * start + 1];
+        for (int s = 1; s <= job->flow_taps.radius && (dx != 0.0f || dy != 0.0f); s++) {
+            px += dx;
+            py += dy;
+            if (px < 0.0f || py < 0.0f || px >= job->width - 1 || py >= job->height - 1) {
+                break;
+            }
+            sum += weights[s] * sample_inside(job->response, job->width, px, py);
+            total += weights[s];
+
+            // Tangents have no sign; keep travelling the way we came
+            const float* t = job->tangent + 2 * ((size_t)(int)(py + 0.5f) * job->width + (int)(px + 0.5f));
+            float flip = t[0] * dx + t[1] * dy < 0.0f ? -1.0f : 1.0f;
+            dx = flip * t[0];
+            dy = flip * t[1];
+        }
+    }
+    return sum / total;
+}
+
+static void flow_band(int begin, int end, void* context) {
+    const FlowJob* job = (const FlowJob*)context;
+    float smoothed[FLOW_TILE_SIZE];
+
+    for (int tile = begin; tile < end; tile++) {
+        int x0, y0, x1, y1;
+        get_tile_bounds(job, tile, &x0, &y0, &x1, &y1);
+
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                smoothed[x - x0] = integrate_flow(job, x, y);
+            }
+            // Non-negative responses (flat areas, the light side of an edge) stay white
+            soft_threshold_tone(smoothed, x1 - x0, 0.0f, job->options->phi, job->tone->data + (size_t)y * job->width + x0);
+        }
+    }
+}
+
+ToneField apply_flow_dog(const Image* src, const FlowDoGOptions* options) {
+    FlowJob job;
+    size_t pixels = (size_t)src->width * src->height;
+
+    job.src = src;
+    job.options = options;
+    job.width = src->width;
+    job.height = src->height;
+    job.tiles_across = (src->width + FLOW_TILE_SIZE - 1) / FLOW_TILE_SIZE;
+    int tiles = job.tiles_across * ((src->height + FLOW_TILE_SIZE - 1) / FLOW_TILE_SIZE);
+
+    job.tensor_taps = make_gaussian_taps(options->tensor_sigma);
+    job.flow_taps = make_gaussian_taps(options->flow_sigma);
+    SymmetricTaps center = make_gaussian_taps(options->sigma);
+    job.dog_taps = make_gaussian_taps(options->sigma * options->sigma_scale);
+    for (int i = 0; i <= job.dog_taps.radius; i++) {
+        float inner = i <= center.radius ? center.weights[i] : 0.0f;
+        job.dog_taps.weights[i] = inner - options->tau * job.dog_taps.weights[i];
+    }
+    free(center.weights);
+
+    job.luma = (float*)safe_malloc(pixels * sizeof(float));
+    parallel_for(src->height, FLOW_MIN_BAND_ROWS, luma_band, &job);
+
+    job.tensor = (float*)safe_malloc(pixels * 3 * sizeof(float));
+    parallel_for(src->height, FLOW_MIN_BAND_ROWS, tensor_rows_band, &job);
+    job.tangent = (float*)safe_malloc(pixels * 2 * sizeof(float));
+    parallel_for(src->height, FLOW_MIN_BAND_ROWS, tangent_band, &job);
+    free(job.tensor);
+
+    job.response = (float*)safe_malloc(pixels * sizeof(float));
+    parallel_for(tiles, 1, across_band, &job);
+
+    ToneField tone;
+    tone.width = src->width;
+    tone.height = src->height;
+    tone.data = (uint16_t*)safe_malloc(pixels * sizeof(uint16_t));
+    job.tone = &tone;
+    parallel_for(tiles, 1, flow_band, &job);
+
+    free(job.luma);
+    free(job.tangent);
+    free(job.response);
+    free(job.tensor_taps.weights);
+    free(job.dog_taps.weights);
+    free(job.flow_taps.weights);
+    return tone;
+}
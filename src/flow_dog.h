@@ -0,0 +1,27 @@
+// flow_dog.h
+
+#ifndef FLOW_DOG_H
+#define FLOW_DOG_H
+
+#include "image_loader.h"
+#include "edge_detection.h"
+
+// Parameters of apply_flow_dog; sigmas are in pixels, values in [0, 1] luma units
+typedef struct {
+    float tensor_sigma;  // Smoothing of the structure tensor the flow is taken from
+    float sigma;         // Center Gaussian of the DoG across the flow
+    float sigma_scale;   // Surround Gaussian at sigma times this (above 1)
+    float tau;           // Weight of the surround; just under 1 keeps flat areas white
+    float flow_sigma;    // Gaussian along the flow; larger joins longer stretches of a contour
+    float phi;           // Slope of the soft threshold that inks negative responses
+} FlowDoGOptions;
+
+// Flow-based DoG (Kang et al.): an edge tangent field is taken from the Gaussian-smoothed structure
+// tensor of the Sobel gradients, a 1D DoG is filtered across the flow at every pixel, and the
+// responses are then averaged along the flow curve through the pixel (line integral convolution)
+// before the soft threshold of soft_threshold_tone. Contours come out as connected strokes where
+// an isotropic DoG breaks them up. The blurs run in row bands and both flow passes in tiles, on
+// every thread. Needs about 24 bytes per pixel at its peak.
+ToneField apply_flow_dog(const Image* src, const FlowDoGOptions* options);
+
+#endif // FLOW_DOG_H
@@ -5,13 +5,87 @@
 
 #include "image_loader.h"
 
+// Kernels at least this wide are blurred with the recursive engine in GAUSSIAN_ENGINE_AUTO
+#define GAUSSIAN_IIR_MIN_KERNEL 41
+
+// Implementation behind apply_gaussian_blur
+typedef enum {
+    GAUSSIAN_ENGINE_AUTO,  // FIR for small kernels, IIR once the kernel gets wide
+    GAUSSIAN_ENGINE_FIR,   // Truncated kernel, cost grows with kernel_size
+    GAUSSIAN_ENGINE_IIR    // Young-van Vliet recursive filter, cost independent of sigma
+} GaussianEngine;
+
+// Accuracy of the IIR engine measured against the FIR engine on one image
+typedef struct {
+    float max_error;   // Largest absolute difference, in 0-255 levels
+    float mean_error;  // Mean absolute difference, in 0-255 levels
+    float psnr;        // Peak signal-to-noise ratio in dB (INFINITY when identical)
+    double fir_seconds;
+    double iir_seconds;
+} GaussianAccuracy;
+
+// Quantized FIR kernel for blurring many small regions of one image (tiled pipelines)
+typedef struct {
+    int kernel_size;
+    int16_t* weights;
+} GaussianRegionBlur;
+
+// FIR blur of an image whose rows arrive one at a time, top to bottom. Only the horizontal pass of
+// the last kernel_size rows is kept, so memory does not grow with the image height.
+typedef struct {
+    int width;
+    int height;
+    int channels;
+    int kernel_size;
+    int16_t* weights;
+    int rows_pushed;       // Source rows received so far
+    int rows_done;         // Output rows handed to the callback so far
+    uint8_t* ring;         // Horizontal pass of source row y in slot y % kernel_size
+    uint8_t* padded;
+    const uint8_t** taps;
+    uint8_t* output;       // The output row being delivered
+} GaussianRowBlur;
+
+// Receives each finished output row of a streamed blur (width * channels bytes). Rows arrive in
+// no particular order and may be delivered from several threads at once.
+typedef void (*BlurRowCallback)(int y, const uint8_t* row, void* context);
+
 // Apply Gaussian blur to an image
 Image apply_gaussian_blur(const Image* src, int kernel_size, float sigma);
 
+// Apply Gaussian blur but hand each output row to `callback` instead of building the result image
+void apply_gaussian_blur_rows(const Image* src, int kernel_size, float sigma, BlurRowCallback callback, void* context);
+
+// Prepare / release a region blur for the given kernel
+GaussianRegionBlur create_region_blur(int kernel_size, float sigma);
+void free_region_blur(GaussianRegionBlur* blur);
+
+// FIR-blur only the pixels [x0, x1) x [y0, y1) of src into dst ((x1 - x0) * channels bytes per row),
+// reading whatever halo the kernel needs; the result equals that region of apply_gaussian_blur's FIR output
+void blur_image_region(const GaussianRegionBlur* blur, const Image* src, int x0, int y0, int x1, int y1, uint8_t* dst);
+
+// Prepare / release a row-at-a-time blur of a width x height image
+GaussianRowBlur create_row_blur(int width, int height, int channels, int kernel_size, float sigma);
+void free_row_blur(GaussianRowBlur* blur);
+
+// Push the next source row; each output row it completes goes to callback, in order from the top.
+// The rows equal apply_gaussian_blur's FIR output.
+void push_blur_row(GaussianRowBlur* blur, const uint8_t* row, BlurRowCallback callback, void* context);
+
+// Smallest odd kernel covering +-3 sigma
+int gaussian_kernel_size(float sigma);
+
+// Select the engine used by apply_gaussian_blur (GAUSSIAN_ENGINE_AUTO by default)
+void set_gaussian_engine(GaussianEngine engine);
+GaussianEngine get_gaussian_engine(void);
+
+// Engine (FIR or IIR) apply_gaussian_blur will actually use for this kernel
+GaussianEngine resolve_gaussian_engine(int kernel_size, float sigma);
+
+// Blur src with both engines and report how far the IIR result is from the FIR one
+GaussianAccuracy compare_gaussian_engines(const Image* src, int kernel_size, float sigma);
+
 // Create a 1D Gaussian kernel
 float* create_gaussian_kernel(int kernel_size, float sigma);
 
-// Apply a 1D convolution (used for separable Gaussian blur)
-Image apply_1d_convolution(const Image* src, const float* kernel, int kernel_size, int direction);
-
 #endif // GAUSSIAN_BLUR_H
\ No newline at end of file
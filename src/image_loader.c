@@ -1,60 +1,715 @@
 // image_loader.c
 
+#define _POSIX_C_SOURCE 200809L
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "../include/stb_image.h"
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "../include/stb_image_resize2.h"
 #include "image_loader.h"
+#include "thread_pool.h"
 #include "utils.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-Image load_image(const char* filename) {
+// Longest PNM header open_pnm_rows accepts, comments included
+#define PNM_HEADER_MAX 4096
+
+// Bytes read at a time when an image arrives on a pipe
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Image load_image(const char* filename, ImageChannels layout, int min_width) {
     Image img;
-    img.data = stbi_load(filename, &img.width, &img.height, &img.channels, 0);
-    
-    if (!img.data) {
-        error_exit("Failed to load image: %s", filename);
+    if (!try_load_image(filename, layout, min_width, &img)) {
+        error_exit("Failed to load image: %s (%s)", filename, image_load_failure());
     }
     
     return img;
 }
 
+// Read one header number of a binary PNM file, skipping whitespace and comments; -1 on error
+static long parse_pnm_value(const uint8_t* data, size_t size, size_t* pos) {
+    while (*pos < size && (isspace(data[*pos]) || data[*pos] == '#')) {
+        if (data[*pos] == '#') {
+            while (*pos < size && data[*pos] != '\n') {
+                (*pos)++;
+            }
+        } else {
+            (*pos)++;
+        }
+    }
+
+    long value = -1;
+    while (*pos < size && isdigit(data[*pos]) && value < 1L << 24) {
+        value = (value < 0 ? 0 : value * 10) + (data[*pos] - '0');
+        (*pos)++;
+    }
+    return value;
+}
+
+// Header of a binary PGM (P5) or PPM (P6) file with 8-bit samples; *offset is where the samples
+// start. Returns false for anything else.
+static bool parse_pnm_header(const uint8_t* data, size_t size, int* width, int* height, int* channels, size_t* offset) {
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        return false;
+    }
+
+    size_t pos = 2;
+    long header_width = parse_pnm_value(data, size, &pos);
+    long header_height = parse_pnm_value(data, size, &pos);
+    long max_value = parse_pnm_value(data, size, &pos);
+
+    // Exactly one whitespace byte separates the header from the samples
+    if (header_width <= 0 || header_height <= 0 || max_value != 255 || pos >= size || !isspace(data[pos])) {
+        return false;
+    }
+
+    *width = (int)header_width;
+    *height = (int)header_height;
+    *channels = data[1] == '6' ? 3 : 1;
+    *offset = pos + 1;
+    return true;
+}
+
+#ifndef _WIN32
+
+// Binary PGM and PPM files with 8-bit samples are stored exactly as an Image lays out its
+// pixels, so img can point straight into the mapping. Returns false for anything else.
+static bool map_raw_pnm(const uint8_t* data, size_t size, Image* img) {
+    int width, height, channels;
+    size_t pos;
+    if (!parse_pnm_header(data, size, &width, &height, &channels, &pos)) {
+        return false;
+    }
+    if ((size - pos) / channels / width < (size_t)height) {
+        return false;
+    }
+
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    img->data = (uint8_t*)data + pos;
+    return true;
+}
+
+// Map a regular file read-only; pipes and other special files return false
+static bool map_file(const char* filename, void** mapping, size_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0 || info.st_size > INT_MAX) {
+        close(fd);
+        return false;
+    }
+    *size = (size_t)info.st_size;
+    *mapping = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (*mapping == MAP_FAILED) {
+        return false;
+    }
+
+    // The decoders read front to back once; let the kernel read ahead and drop pages behind
+    posix_madvise(*mapping, *size, POSIX_MADV_SEQUENTIAL);
+    return true;
+}
+
+#endif
+
+// req_comp to hand stb for a file stored with `stored` channels (0 when unknown). Gray output is
+// decoded as RGB and reduced by convert_to_luma, because stb's own gray conversion uses Rec. 601.
+static int decode_channels(ImageChannels layout, int stored) {
+    if (layout == IMAGE_CHANNELS_ANY || stored == 0) {
+        return 0;
+    }
+    return stored < 3 ? 1 : 3;
+}
+
+// Largest decoded image try_load_image accepts, in bytes; 0 for no limit
+static size_t image_memory_limit = 0;
+
+// How a file will be decoded, worked out from its header before any pixel is decoded
+typedef struct {
+    int requested;      // req_comp for stb
+    int scale;          // 1, or JPEG_DC_SCALE for a DC-only JPEG decode
+    size_t peak_bytes;  // Decoded pixels, plus the luma copy when gray output is made from color
+} DecodePlan;
+
+// False (with stb's failure reason set) when the decode would go over the memory limit
+static bool plan_decode(int width, int height, int stored, int scale, ImageChannels layout, DecodePlan* plan) {
+    plan->requested = decode_channels(layout, stored);
+    plan->scale = scale;
+
+    int decoded = plan->requested ? plan->requested : stored;
+    if (scale > 1) {
+        decoded = stored < 3 ? 1 : 3;
+    }
+    size_t pixels = (size_t)((width + scale - 1) / scale) * (size_t)((height + scale - 1) / scale);
+    plan->peak_bytes = pixels * (size_t)(decoded + (layout == IMAGE_CHANNELS_GRAY && decoded > 1 ? 1 : 0));
+
+    if (image_memory_limit > 0 && plan->peak_bytes > image_memory_limit) {
+        stbi__err("over memory limit", "Image is larger than the memory limit");
+        return false;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+
+// A mapped PNM takes no heap for its pixels, so only the luma copy of a color file made for gray
+// output counts against the memory limit. False (with stb's failure reason set) when it is over.
+static bool plan_mapped(const Image* img, ImageChannels layout) {
+    size_t heap_bytes = layout == IMAGE_CHANNELS_GRAY && img->channels > 1 ? (size_t)img->width * img->height : 0;
+    if (image_memory_limit > 0 && heap_bytes > image_memory_limit) {
+        stbi__err("over memory limit", "Image is larger than the memory limit");
+        return false;
+    }
+    return true;
+}
+
+// Reduced JPEG decode: a file at least JPEG_DC_SCALE times wider than the caller needs is decoded
+// at 1/8 scale, one pixel per 8x8 block taken from its DC coefficient
+#define JPEG_DC_SCALE 8
+
+// Stands in for stb's IDCT: the block mean is the (already dequantized) DC term, stored with the
+// same rounding the full IDCT gives a DC-only block, in the block's top-left byte
+static void store_block_dc(stbi_uc* out, int out_stride, short data[64]) {
+    (void)out_stride;
+    out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
+static bool is_jpeg(const stbi_uc* data, size_t size) {
+    return size >= 2 && data[0] == 0xFF && data[1] == 0xD8;
+}
+
+// Bytes of the full-resolution component planes stb allocates for a JPEG before any IDCT runs
+// (one byte per sample, padded to whole MCUs, plus 16-bit coefficients when progressive); the DC
+// decode fills these too. 0 when the frame header cannot be read.
+static size_t jpeg_plane_bytes(const stbi_uc* data, size_t size) {
+    stbi__context context;
+    stbi__start_mem(&context, data, (int)size);
+    stbi__jpeg* jpeg = (stbi__jpeg*)safe_malloc(sizeof(stbi__jpeg));
+    memset(jpeg, 0, sizeof(*jpeg));
+    jpeg->s = &context;
+
+    size_t bytes = 0;
+    if (stbi__decode_jpeg_header(jpeg, STBI__SCAN_header)) {
+        int h_max = 1, v_max = 1;
+        for (int k = 0; k < context.img_n; k++) {
+            h_max = jpeg->img_comp[k].h > h_max ? jpeg->img_comp[k].h : h_max;
+            v_max = jpeg->img_comp[k].v > v_max ? jpeg->img_comp[k].v : v_max;
+        }
+        size_t mcu_x = (context.img_x + h_max * 8 - 1) / (h_max * 8);
+        size_t mcu_y = (context.img_y + v_max * 8 - 1) / (v_max * 8);
+        for (int k = 0; k < context.img_n; k++) {
+            size_t samples = mcu_x * jpeg->img_comp[k].h * 8 * mcu_y * jpeg->img_comp[k].v * 8;
+            bytes += samples * (jpeg->progressive ? 1 + sizeof(short) : 1);
+        }
+    }
+    free(jpeg);
+    return bytes;
+}
+
+// A DC decode holds the component planes as well as its 1/64 size output. False (with stb's
+// failure reason set) when that is over the memory limit.
+static bool plan_jpeg_dc(const stbi_uc* data, size_t size, DecodePlan* plan) {
+    plan->peak_bytes += jpeg_plane_bytes(data, size);
+    if (image_memory_limit > 0 && plan->peak_bytes > image_memory_limit) {
+        stbi__err("over memory limit", "Image is larger than the memory limit");
+        return false;
+    }
+    return true;
+}
+
+// Decode a gray or YCbCr/RGB JPEG at 1/8 scale. Entropy decoding still runs in full (it cannot be
+// skipped in baseline files); the IDCT, chroma upsampling and color conversion run on 1/64 of the
+// pixels. Returns NULL for CMYK files and on errors, leaving the caller to do a full decode.
+static stbi_uc* load_jpeg_dc(const stbi_uc* data, size_t size, int* width, int* height, int* channels) {
+    if (size > INT_MAX) {
+        return NULL;
+    }
+    stbi__context context;
+    stbi__start_mem(&context, data, (int)size);
+    stbi__jpeg* jpeg = (stbi__jpeg*)safe_malloc(sizeof(stbi__jpeg));
+    memset(jpeg, 0, sizeof(*jpeg));
+    jpeg->s = &context;
+    stbi__setup_jpeg(jpeg);
+    jpeg->idct_block_kernel = store_block_dc;
+    context.img_n = 0;  // Keeps stbi__cleanup_jpeg safe if the header is rejected
+
+    stbi_uc* result = NULL;
+    int n = 0;
+    if (stbi__decode_jpeg_image(jpeg)) {
+        n = context.img_n;
+    }
+    if (n == 1 || n == 3) {
+        int w = (int)((context.img_x + 7) / 8);
+        int h = (int)((context.img_y + 7) / 8);
+        bool is_rgb = n == 3 && (jpeg->rgb == 3 || (jpeg->app14_color_transform == 0 && !jpeg->jfif));
+        // One spare byte: stb's color conversion also writes an alpha byte after the last pixel
+        result = (stbi_uc*)safe_malloc((size_t)w * h * n + 1);
+        stbi_uc* planes = (stbi_uc*)safe_malloc((size_t)w * n);
+
+        for (int y = 0; y < h; y++) {
+            // Gather this row's DC pixels per component; subsampled components repeat their blocks
+            for (int k = 0; k < n; k++) {
+                int by = y * jpeg->img_comp[k].v / jpeg->img_v_max;
+                const stbi_uc* row = jpeg->img_comp[k].data + (size_t)by * 8 * jpeg->img_comp[k].w2;
+                for (int x = 0; x < w; x++) {
+                    planes[(size_t)k * w + x] = row[(size_t)(x * jpeg->img_comp[k].h / jpeg->img_h_max) * 8];
+                }
+            }
+
+            stbi_uc* out = result + (size_t)y * w * n;
+            if (n == 1) {
+                memcpy(out, planes, (size_t)w);
+            } else if (is_rgb) {
+                for (int x = 0; x < w; x++) {
+                    out[x * 3] = planes[x];
+                    out[x * 3 + 1] = planes[w + x];
+                    out[x * 3 + 2] = planes[2 * w + x];
+                }
+            } else {
+                jpeg->YCbCr_to_RGB_kernel(out, planes, planes + w, planes + 2 * w, w, 3);
+            }
+        }
+
+        free(planes);
+        *width = w;
+        *height = h;
+        *channels = n;
+    }
+
+    stbi__cleanup_jpeg(jpeg);
+    free(jpeg);
+    return result;
+}
+
+#endif
+
+// A pipe read through its own large buffer: stb refills a 128-byte buffer from its callbacks, so
+// without this it would be drained one small read at a time
+typedef struct {
+    FILE* file;
+    char* buffer;
+    size_t start;
+    size_t end;
+} BufferedInput;
+
+static int read_buffered(void* user, char* data, int size) {
+    BufferedInput* input = (BufferedInput*)user;
+    size_t copied = 0;
+
+    while (copied < (size_t)size) {
+        if (input->start == input->end) {
+            input->start = 0;
+            input->end = fread(input->buffer, 1, STREAM_BUFFER_SIZE, input->file);
+            if (input->end == 0) {
+                break;
+            }
+        }
+        size_t count = input->end - input->start;
+        if (count > (size_t)size - copied) {
+            count = (size_t)size - copied;
+        }
+        memcpy(data + copied, input->buffer + input->start, count);
+        input->start += count;
+        copied += count;
+    }
+    return (int)copied;
+}
+
+static void skip_buffered(void* user, int n) {
+    BufferedInput* input = (BufferedInput*)user;
+    char discard[4096];
+
+    // stb only ever skips forward
+    size_t remaining = n > 0 ? (size_t)n : 0;
+    while (remaining > 0) {
+        int chunk = remaining < sizeof(discard) ? (int)remaining : (int)sizeof(discard);
+        int skipped = read_buffered(input, discard, chunk);
+        if (skipped == 0) {
+            break;
+        }
+        remaining -= skipped;
+    }
+}
+
+static int eof_buffered(void* user) {
+    BufferedInput* input = (BufferedInput*)user;
+    return input->start == input->end && (feof(input->file) || ferror(input->file));
+}
+
+// The first buffer of a stream (stdin, or a pipe named by path) is read before decoding starts, so
+// the header is probed from it just like a mapped file; stb then decodes from the start of that buffer
+static stbi_uc* load_stream_image(FILE* file, ImageChannels layout, int* width, int* height, int* channels,
+                                  int* requested) {
+    static const stbi_io_callbacks callbacks = { read_buffered, skip_buffered, eof_buffered };
+    BufferedInput input = { file, NULL, 0, 0 };
+    stbi_uc* data = NULL;
+
+    input.buffer = (char*)safe_malloc(STREAM_BUFFER_SIZE);
+    input.end = fread(input.buffer, 1, STREAM_BUFFER_SIZE, file);
+
+    // A header that does not fit in the first buffer decodes unprobed, as stored
+    int header_width, header_height, stored;
+    DecodePlan plan = { 0, 1, 0 };
+    if (!stbi_info_from_memory((const stbi_uc*)input.buffer, (int)input.end, &header_width, &header_height, &stored) ||
+        plan_decode(header_width, header_height, stored, 1, layout, &plan)) {
+        data = stbi_load_from_callbacks(&callbacks, &input, width, height, channels, plan.requested);
+        *requested = plan.requested;
+    }
+    free(input.buffer);
+    return data;
+}
+
+#ifndef _WIN32
+
+// Regular files can be probed by name and then opened again to decode; a pipe would lose the
+// bytes the probe read, so it is probed from its first buffer instead
+static bool is_regular_file(const char* filename) {
+    struct stat info;
+    return stat(filename, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+#endif
+
+void set_image_memory_limit(size_t bytes) {
+    image_memory_limit = bytes;
+}
+
+const char* image_load_failure(void) {
+    const char* reason = stbi_failure_reason();
+    return reason ? reason : "unknown error";
+}
+
+// Like load_image, but a file that cannot be decoded returns false instead of exiting. The header is
+// probed before decoding (from the first buffer of a pipe), so an image over the memory limit fails
+// before its pixels are allocated.
+bool try_load_image(const char* filename, ImageChannels layout, int min_width, Image* img) {
+    int requested = 0;
+    int width, height, stored;
+    DecodePlan plan;
+    img->data = NULL;
+    img->mapping = NULL;
+    img->mapping_size = 0;
+
+#ifndef _WIN32
+    // Decode straight from the page cache instead of copying the file into a heap buffer first
+    void* mapping;
+    size_t size;
+#endif
+    if (strcmp(filename, IMAGE_STDIN) == 0) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        img->data = load_stream_image(stdin, layout, &img->width, &img->height, &img->channels, &requested);
+    }
+#ifndef _WIN32
+    // Checked without opening the file: opening a FIFO to probe it would take its writer away
+    else if (!is_regular_file(filename)) {
+        FILE* file = fopen(filename, "rb");
+        if (file) {
+            img->data = load_stream_image(file, layout, &img->width, &img->height, &img->channels, &requested);
+            fclose(file);
+        } else {
+            stbi__err("can't fopen", "Unable to open file");
+        }
+    } else if (map_file(filename, &mapping, &size)) {
+        const stbi_uc* data = (const stbi_uc*)mapping;
+        if (map_raw_pnm(data, size, img)) {
+            if (plan_mapped(img, layout)) {
+                img->mapping = mapping;
+                img->mapping_size = size;
+                mapping = NULL;
+            } else {
+                img->data = NULL;
+            }
+        } else if (stbi_info_from_memory(data, (int)size, &width, &height, &stored) &&
+                   plan_decode(width, height, stored,
+                               min_width > 0 && width / JPEG_DC_SCALE >= min_width && is_jpeg(data, size) ? JPEG_DC_SCALE : 1,
+                               layout, &plan) &&
+                   (plan.scale == 1 || plan_jpeg_dc(data, size, &plan))) {
+            if (plan.scale > 1) {
+                img->data = load_jpeg_dc(data, size, &img->width, &img->height, &img->channels);
+            }
+            // A JPEG the DC decoder cannot take is decoded in full, if that still fits
+            if (!img->data && (plan.scale == 1 || plan_decode(width, height, stored, 1, layout, &plan))) {
+                requested = plan.requested;
+                img->data = stbi_load_from_memory(data, (int)size, &img->width, &img->height, &img->channels, requested);
+            }
+        }
+        if (mapping) {
+            munmap(mapping, size);
+        }
+    }
+#endif
+    else if (stbi_info(filename, &width, &height, &stored) && plan_decode(width, height, stored, 1, layout, &plan)) {
+        requested = plan.requested;
+        img->data = stbi_load(filename, &img->width, &img->height, &img->channels, requested);
+    }
+
+    if (!img->data) {
+        img->width = img->height = img->channels = 0;
+        return false;
+    }
+
+    // stb reports the stored channel count; the buffer holds what was requested
+    if (requested != 0) {
+        img->channels = requested;
+    }
+    if (layout == IMAGE_CHANNELS_GRAY) {
+        convert_to_luma(img);
+    }
+    
+    return true;
+}
+
+bool open_pnm_rows(const char* filename, ImageChannels layout, PnmRowReader* reader) {
+    uint8_t header[PNM_HEADER_MAX];
+    size_t offset;
+    reader->file = fopen(filename, "rb");
+    reader->raw = NULL;
+    if (!reader->file) {
+        return false;
+    }
+
+    size_t length = fread(header, 1, sizeof(header), reader->file);
+    if (!parse_pnm_header(header, length, &reader->width, &reader->height, &reader->stored_channels, &offset) ||
+        fseek(reader->file, (long)offset, SEEK_SET) != 0) {
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
+    }
+
+    // Same channels try_load_image produces: luma for gray output, the stored samples otherwise
+    reader->channels = layout == IMAGE_CHANNELS_GRAY ? 1 : reader->stored_channels;
+    if (reader->channels != reader->stored_channels) {
+        reader->raw = (uint8_t*)safe_malloc((size_t)reader->width * reader->stored_channels);
+    }
+    return true;
+}
+
+bool read_pnm_row(PnmRowReader* reader, uint8_t* row) {
+    uint8_t* target = reader->raw ? reader->raw : row;
+    size_t length = (size_t)reader->width * reader->stored_channels;
+    if (fread(target, 1, length, reader->file) != length) {
+        return false;
+    }
+    if (reader->raw) {
+        convert_row_to_luma(reader->raw, reader->stored_channels, reader->width, row);
+    }
+    return true;
+}
+
+void close_pnm_rows(PnmRowReader* reader) {
+    if (reader->file) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+    free(reader->raw);
+    reader->raw = NULL;
+}
+
 void free_image(Image* img) {
+#ifndef _WIN32
+    if (img->mapping) {
+        munmap(img->mapping, img->mapping_size);
+        img->mapping = NULL;
+        img->mapping_size = 0;
+        img->data = NULL;
+    }
+#endif
     if (img->data) {
         stbi_image_free(img->data);
-        img->data = NULL;
     }
+    img->data = NULL;
     img->width = img->height = img->channels = 0;
 }
 
 Image create_image(int width, int height, int channels) {
     Image img;
+    if (width <= 0 || height <= 0 || (size_t)width * (size_t)height > SIZE_MAX / (size_t)channels) {
+        error_exit("Invalid image size %dx%d", width, height);
+    }
     img.width = width;
     img.height = height;
     img.channels = channels;
-    img.data = (uint8_t*)safe_malloc(width * height * channels);
+    img.data = (uint8_t*)safe_malloc((size_t)width * height * channels);
+    img.mapping = NULL;
+    img.mapping_size = 0;
     
     return img;
 }
 
+// Runs a range of the splits prepared by stbir_build_samplers_with_splits
+static void resize_band(int begin, int end, void* context) {
+    stbir_resize_extended_split((STBIR_RESIZE*)context, begin, end - begin);
+}
+
 Image resize_image(const Image* src, int new_width, int new_height) {
     Image dst = create_image(new_width, new_height, src->channels);
     
-    stbir_resize_uint8_linear(
+    // Same resize as stbir_resize_uint8_linear, with the output rows split across the pool
+    STBIR_RESIZE resize;
+    stbir_resize_init(&resize,
         src->data, src->width, src->height, 0,
         dst.data, dst.width, dst.height, 0,
-        src->channels);
+        (stbir_pixel_layout)src->channels, STBIR_TYPE_UINT8);
+    
+    int splits = stbir_build_samplers_with_splits(&resize, thread_pool_size());
+    if (splits == 0) {
+        error_exit("Failed to resize image to %dx%d", new_width, new_height);
+    }
+    parallel_for(splits, 1, resize_band, &resize);
+    stbir_free_samplers(&resize);
+    
+    return dst;
+}
+
+Image copy_image(const Image* src) {
+    Image dst = create_image(src->width, src->height, src->channels);
+    memcpy(dst.data, src->data, (size_t)src->width * src->height * src->channels);
     
     return dst;
 }
 
+// Size of the working image for a grid of cell_columns x cell_rows: oversample x (2 * oversample)
+// pixels per cell, or the source size when that would not be smaller
+void get_working_size(int width, int height, int cell_columns, int cell_rows, int oversample, int* working_width, int* working_height) {
+    *working_width = cell_columns * oversample;
+    *working_height = cell_rows * oversample * 2;
+
+    // Never upsample; small inputs are already cheap to filter
+    if (*working_width >= width || *working_height >= height) {
+        *working_width = width;
+        *working_height = height;
+    }
+}
+
+// Downsample src so that every output cell covers oversample x (2 * oversample) pixels.
+// Filters only ever need a few pixels per cell, so running them on the working image
+// instead of the decoded one skips nearly all of the work for large photos.
+Image create_working_image(const Image* src, int cell_columns, int cell_rows, int oversample) {
+    int width, height;
+    get_working_size(src->width, src->height, cell_columns, cell_rows, oversample, &width, &height);
+    if (width == src->width && height == src->height) {
+        return copy_image(src);
+    }
+    
+    return resize_image(src, width, height);
+}
+
+// State of resize_image_rows, shared by stbir's input and output callbacks
+typedef struct {
+    ImageRowReader read;
+    ImageRowWriter write;
+    void* context;
+    uint8_t* row;   // Source row rows_read - 1
+    int rows_read;
+    int channels;
+    bool failed;
+} RowResize;
+
+// Run as a single split, stbir asks for source rows in non-decreasing order (repeating the border
+// rows for its edge taps), so reading ahead to the requested row is all the seeking needed
+static const void* resize_input_row(void* optional_output, const void* input_ptr, int num_pixels, int x, int y, void* context) {
+    (void)optional_output;
+    (void)input_ptr;
+    (void)num_pixels;
+    RowResize* resize = (RowResize*)context;
+    while (resize->rows_read <= y) {
+        if (!resize->failed && !resize->read(resize->row, resize->context)) {
+            resize->failed = true;
+        }
+        resize->rows_read++;
+    }
+    return resize->row + (size_t)x * resize->channels;
+}
+
+static void resize_output_row(const void* output, int num_pixels, int y, void* context) {
+    (void)num_pixels;
+    RowResize* resize = (RowResize*)context;
+    resize->write(y, (const uint8_t*)output, resize->context);
+}
+
+bool resize_image_rows(int width, int height, int channels, int new_width, int new_height,
+                       ImageRowReader read, ImageRowWriter write, void* context) {
+    RowResize state = { read, write, context, NULL, 0, channels, false };
+    state.row = (uint8_t*)safe_calloc((size_t)width * channels, 1);
+
+    STBIR_RESIZE resize;
+    stbir_resize_init(&resize, NULL, width, height, 0, NULL, new_width, new_height, 0,
+                      (stbir_pixel_layout)channels, STBIR_TYPE_UINT8);
+    stbir_set_pixel_callbacks(&resize, resize_input_row, resize_output_row);
+    stbir_set_user_data(&resize, &state);
+    if (!stbir_resize_extended(&resize)) {
+        error_exit("Failed to resize image to %dx%d", new_width, new_height);
+    }
+
+    free(state.row);
+    return !state.failed;
+}
+
+// Rec. 709 luma in 8-bit fixed point (weights 54, 183, 19 out of 256); for one- and two-channel
+// sources this just takes channel 0
+void convert_row_to_luma(const uint8_t* src, int channels, size_t count, uint8_t* dst) {
+    if (channels < 3) {
+        for (size_t x = 0; x < count; x++) {
+            dst[x] = src[x * channels];
+        }
+        return;
+    }
+    for (size_t x = 0; x < count; x++) {
+        const uint8_t* p = src + x * channels;
+        dst[x] = (uint8_t)((54 * p[0] + 183 * p[1] + 19 * p[2] + 128) >> 8);
+    }
+}
+
+// Reduce img to one luma channel. A heap image is converted in place (each output byte lands at
+// or before the pixel it came from) and shrunk; a mapped image gets a new buffer.
+void convert_to_luma(Image* img) {
+    if (img->channels == 1) {
+        return;
+    }
+
+    size_t pixels = (size_t)img->width * img->height;
+    if (img->mapping) {
+        uint8_t* luma = (uint8_t*)safe_malloc(pixels);
+        convert_row_to_luma(img->data, img->channels, pixels, luma);
+        int width = img->width, height = img->height;
+        free_image(img);
+        img->width = width;
+        img->height = height;
+        img->data = luma;
+    } else {
+        convert_row_to_luma(img->data, img->channels, pixels, img->data);
+        img->data = (uint8_t*)safe_realloc(img->data, pixels);
+    }
+    img->channels = 1;
+}
+
 float get_pixel(const Image* img, int x, int y, int channel) {
     if (x < 0 || x >= img->width || y < 0 || y >= img->height || channel < 0 || channel >= img->channels) {
         return 0.0f;
     }
     
-    return img->data[(y * img->width + x) * img->channels + channel] / 255.0f;
+    return img->data[((size_t)y * img->width + x) * img->channels + channel] / 255.0f;
 }
 
 void set_pixel(Image* img, int x, int y, int channel, float value) {
@@ -62,5 +717,5 @@ void set_pixel(Image* img, int x, int y, int channel, float value) {
         return;
     }
     
-    img->data[(y * img->width + x) * img->channels + channel] = (uint8_t)(value * 255.0f);
+    img->data[((size_t)y * img->width + x) * img->channels + channel] = (uint8_t)(value * 255.0f);
 }
\ No newline at end of file
@@ -3,19 +3,77 @@
 #ifndef IMAGE_LOADER_H
 #define IMAGE_LOADER_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 typedef struct {
     int width;
     int height;
     int channels;
     uint8_t* data;
+    void* mapping;        // Set when data points into a read-only file mapping (zero-copy load)
+    size_t mapping_size;
 } Image;
 
-Image load_image(const char* filename);
+// Channel layout requested from load_image
+typedef enum {
+    IMAGE_CHANNELS_ANY = 0,   // As stored in the file
+    IMAGE_CHANNELS_GRAY = 1,  // One channel of Rec. 709 luma
+    IMAGE_CHANNELS_COLOR = 3  // RGB, or one channel for gray sources; alpha is dropped
+} ImageChannels;
+
+// Binary PGM/PPM with 8-bit samples read one row at a time, for images too large to load whole
+typedef struct {
+    FILE* file;
+    int width;
+    int height;
+    int channels;         // Channels of the rows read_pnm_row returns
+    int stored_channels;
+    uint8_t* raw;         // One stored row, when it is converted to luma on the way out
+} PnmRowReader;
+
+// Supplies the next row of a source read top to bottom; false on a read error
+typedef bool (*ImageRowReader)(uint8_t* row, void* context);
+
+// Receives output row y of a streamed image
+typedef void (*ImageRowWriter)(int y, const uint8_t* row, void* context);
+
+// Filename that makes load_image read the image from stdin
+#define IMAGE_STDIN "-"
+
+// min_width is the narrowest image the caller can use (0 for full resolution); large JPEGs are
+// then decoded at a reduced scale that still covers it
+Image load_image(const char* filename, ImageChannels layout, int min_width);
+bool try_load_image(const char* filename, ImageChannels layout, int min_width, Image* img);
+
+// Refuse images whose decode would need more than `bytes` (0, the default, for no limit). The size
+// comes from the file header, so oversized inputs fail before any pixel is decoded.
+void set_image_memory_limit(size_t bytes);
+
+// Why the last failed load on this thread failed
+const char* image_load_failure(void);
 void free_image(Image* img);
+
+// Open a binary PGM/PPM for row reading with the channels load_image would give it; false for
+// other files. read_pnm_row fills width * channels bytes.
+bool open_pnm_rows(const char* filename, ImageChannels layout, PnmRowReader* reader);
+bool read_pnm_row(PnmRowReader* reader, uint8_t* row);
+void close_pnm_rows(PnmRowReader* reader);
+
 Image create_image(int width, int height, int channels);
 Image resize_image(const Image* src, int new_width, int new_height);
+Image copy_image(const Image* src);
+Image create_working_image(const Image* src, int cell_columns, int cell_rows, int oversample);
+void get_working_size(int width, int height, int cell_columns, int cell_rows, int oversample, int* working_width, int* working_height);
+
+// Same resize as resize_image for a source read top to bottom through `read`; output rows go to
+// `write` in order as they complete, so neither image is ever held whole. False if a read failed.
+bool resize_image_rows(int width, int height, int channels, int new_width, int new_height,
+                       ImageRowReader read, ImageRowWriter write, void* context);
+void convert_row_to_luma(const uint8_t* src, int channels, size_t count, uint8_t* dst);
+void convert_to_luma(Image* img);
 float get_pixel(const Image* img, int x, int y, int channel);
 void set_pixel(Image* img, int x, int y, int channel, float value);
 
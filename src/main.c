@@ -5,7 +5,14 @@
 #include "image_loader.h"
 #include "gaussian_blur.h"
 #include "edge_detection.h"
+#include "flow_dog.h"
+#include "png_rows.h"
 #include "ascii_converter.h"
+#include "batch.h"
+#include "thread_pool.h"
+#include "stage_plan.h"
+#include "stream_pipeline.h"
+#include "tile_pipeline.h"
 #include "utils.h"
 
 #ifdef __EMSCRIPTEN__
@@ -13,13 +20,346 @@
 #endif
 
 #define DEFAULT_OUTPUT_WIDTH 100
+#define WORKING_OVERSAMPLE 4  // Working image pixels per cell column (twice as many per cell row)
+#define BLUR_KERNEL_SIZE 5
+#define BLUR_SIGMA 1.0f
+#define SOBEL_THRESHOLD 0.5f  // Gradient magnitude (pixels in [0, 1]) above which a pixel is an edge
+#define EDGE_COVERAGE 0.25f   // Share of a cell's pixels that must be edges for it to get an edge glyph
+#define CANNY_LOW_THRESHOLD 0.2f   // Canny hysteresis thresholds, in SOBEL_THRESHOLD units
+#define CANNY_HIGH_THRESHOLD 0.4f
+#define CANNY_COVERAGE 0.35f       // Share of a cell's longer side that Canny lines must add up to
+#define XDOG_SIGMA_SCALE 1.6f  // XDoG: second blur at BLUR_SIGMA times this
+#define XDOG_TAU 0.95f         // Weight of the second blur, sharpening by tau / (1 - tau)
+#define XDOG_EPSILON 0.6f      // Sharpened luma at and above which the tone stays white
+#define XDOG_PHI 4.0f          // Slope of the darkening below epsilon
+#define FDOG_TENSOR_SIGMA 2.0f  // FDoG: smoothing of the structure tensor behind the flow
+#define FDOG_SIGMA 1.0f         // DoG across the flow, surround at XDOG_SIGMA_SCALE times this
+#define FDOG_TAU 0.99f
+#define FDOG_FLOW_SIGMA 3.0f    // Smoothing along the flow
+#define FDOG_PHI 20.0f          // Ink slope of negative responses
+#define OUTPUT_FILENAME_MAX 4096
+#define DEFAULT_MEMORY_LIMIT_MB 4096  // Largest decoded image accepted; --stream needs none of it
+
+static const XDoGOptions XDOG_OPTIONS = { XDOG_SIGMA_SCALE, XDOG_TAU, XDOG_EPSILON, XDOG_PHI };
+
+// Everything that decides how one loaded image becomes ASCII art
+typedef struct {
+    int output_width;
+    bool staged;
+    StageSet stages;       // Stages the output consumes; the rest are never run
+    ImageChannels layout;  // What the decoder delivers: gray when the plan reduces to luma
+    ASCIIOptions options;
+} ConversionSettings;
 
 void print_usage(const char* program_name) {
-    printf("Usage: %s <input_image> [output_width] [--color|-c] [--edge|-e]\n", program_name);
-    printf("  input_image: Path to the input image file\n");
+    printf("Usage: %s <input_image> [output_width] [--color|-c] [--edge|-e] [--canny] [--xdog] [--fdog] [--full-res|-f] [--blur-engine auto|fir|iir] [--blur-report] [--charset chars] [--color-levels n] [--no-coalesce] [--threads n] [--memory-limit mb] [--output|-o path] [--no-save] [--staged] [--stream] [--batch] [--stages d,p,w] [--no-pipeline] [--explain]\n", program_name);
+    printf("  input_image: Path to the input image file, or - to read the image from stdin; with --batch a directory, a glob pattern or - for paths on stdin\n");
     printf("  output_width: Width of the output ASCII art (default: %d)\n", DEFAULT_OUTPUT_WIDTH);
     printf("  --color|-c: Enable color output for console (optional)\n");
-    printf("  --edge|-e: Enable edge detection (optional, not implemented yet)\n");
+    printf("  --edge|-e: Draw edges with |-\\/ characters (optional)\n");
+    printf("  --canny: Draw edges traced by the Canny detector: thin, connected lines that stay clean at large widths; cannot be combined with --edge (optional)\n");
+    printf("  --xdog: Shade with the extended difference-of-Gaussians: flat tones and inked outlines (optional)\n");
+    printf("  --fdog: Shade with the flow-based DoG: line art whose contours follow the image's edge flow; cannot be combined with --xdog (optional)\n");
+    printf("  --full-res|-f: Filter the full decoded image instead of downsampling to the cell grid first (optional)\n");
+    printf("  --blur-engine: Gaussian blur implementation; iir keeps the cost independent of sigma (default: auto)\n");
+    printf("  --blur-report: Print the accuracy and timing of the IIR blur against the FIR blur (optional)\n");
+    printf("  --color-levels: Quantize each color component to n levels so runs of similar cells share one escape (optional)\n");
+    printf("  --no-coalesce: Give every colored cell its own color escape and reset, as older versions did, instead of one escape per run of equal colors (optional)\n");
+    printf("  --charset: Glyphs from darkest to brightest, UTF-8 allowed (default: \"%s\")\n", ASCII_CHARS);
+    printf("  --threads: Number of threads for the filter stages, 0 for one per core (default: 0)\n");
+    printf("  --memory-limit: Refuse images whose decode needs more than this many MB, checked from the header before decoding (a binary PPM/PGM is read in place and only charged for its copies); 0 for no limit (default: %d)\n", DEFAULT_MEMORY_LIMIT_MB);
+    printf("  --output|-o: Save the text to this file instead of <input_image>_ascii.txt (optional)\n");
+    printf("  --no-save: Only print the text; nothing is saved, as for images read from stdin without --output (optional)\n");
+    printf("  --staged: Run each filter over the whole image instead of fusing them per tile (optional)\n");
+    printf("  --stream: Read a binary PPM/PGM or a non-interlaced PNG a row at a time and write each ASCII row as soon as it is done, for images too large to load; "
+           "other files, --canny, --xdog, --fdog and the IIR blur are loaded whole, with a warning (optional)\n");
+    printf("  --batch: Convert every input image concurrently, save each <image>_ascii.txt and report throughput (optional)\n");
+    printf("  --stages: Batch decode, process and write threads (default: half the threads, the threads, 1)\n");
+    printf("  --no-pipeline: Batch without separate stages; each thread decodes, processes and writes whole images (optional)\n");
+    printf("  --explain: Print the stages this conversion runs, what each reads, and the ones it skips (optional)\n");
+}
+
+void print_blur_report(const Image* img, int kernel_size, float sigma) {
+    GaussianAccuracy report = compare_gaussian_engines(img, kernel_size, sigma);
+    fprintf(stderr, "Blur kernel %d sigma %.2f on %dx%d: IIR vs FIR max error %.0f, mean error %.3f, PSNR %.1f dB; "
+            "FIR %.1f ms, IIR %.1f ms\n",
+            kernel_size, sigma, img->width, img->height, report.max_error, report.mean_error, report.psnr,
+            report.fir_seconds * 1000.0, report.iir_seconds * 1000.0);
+}
+
+// Narrowest decode prepare_working_image can use without upsampling; lets large JPEGs decode at reduced scale
+int decode_min_width(const ConversionSettings* settings) {
+    return stage_planned(settings->stages, STAGE_RESIZE) ? settings->output_width * WORKING_OVERSAMPLE : 0;
+}
+
+// Downsample to a small multiple of the cell grid so the filters only touch pixels that reach the output
+void prepare_working_image(Image* img, const ConversionSettings* settings) {
+    if (stage_planned(settings->stages, STAGE_RESIZE)) {
+        int ascii_height = compute_ascii_height(img->width, img->height, settings->output_width);
+        Image working = create_working_image(img, settings->output_width, ascii_height, WORKING_OVERSAMPLE);
+        free_image(img);
+        *img = working;
+    }
+}
+
+// Each filter over the whole image in turn; used for --staged, the IIR blur and Canny. XDoG tones
+// the same blur the cells are sampled from.
+CellGrid build_staged_grid(const Image* img, const ConversionSettings* settings) {
+    bool detect_edges = stage_planned(settings->stages, STAGE_SOBEL);
+    bool trace_edges = stage_planned(settings->stages, STAGE_CANNY);
+
+    // Apply Gaussian blur
+    Image blurred = apply_gaussian_blur(img, BLUR_KERNEL_SIZE, BLUR_SIGMA);
+
+    // Initialize edges as an empty image
+    Image edges = {0};
+
+    if (detect_edges) {
+        // One packed edge byte (flag + direction) per cell, voted by the Sobel directions of its pixels
+        int ascii_height = compute_ascii_height(blurred.width, blurred.height, settings->output_width);
+        edges = detect_cell_edges(&blurred, SOBEL_THRESHOLD, EDGE_COVERAGE, settings->output_width, ascii_height);
+    } else if (trace_edges) {
+        Image lines = detect_canny_edges(&blurred, CANNY_LOW_THRESHOLD, CANNY_HIGH_THRESHOLD);
+        int ascii_height = compute_ascii_height(blurred.width, blurred.height, settings->output_width);
+        edges = vote_cell_edges(&lines, CANNY_COVERAGE, settings->output_width, ascii_height);
+        free_image(&lines);
+    }
+
+    CellSampler sampler = build_cell_sampler(&blurred);
+    CellGrid grid = build_cell_grid(&sampler, &edges, &settings->options, settings->output_width);
+
+    if (stage_planned(settings->stages, STAGE_XDOG)) {
+        // Glyph density from the XDoG tone of the blur; edge glyphs and colors are kept
+        ToneField tone = apply_xdog(&blurred, BLUR_KERNEL_SIZE, BLUR_SIGMA, &XDOG_OPTIONS);
+        apply_cell_tone(&grid, &tone);
+        free_tone_field(&tone);
+    }
+
+    free_cell_sampler(&sampler);
+    free_image(&blurred);
+    free_image(&edges);
+    return grid;
+}
+
+ASCIIArt convert_image(const Image* img, const ConversionSettings* settings) {
+    const ASCIIOptions* options = &settings->options;
+    bool detect_edges = stage_planned(settings->stages, STAGE_SOBEL);
+    bool trace_edges = stage_planned(settings->stages, STAGE_CANNY);
+    CellGrid grid;
+
+    // Canny's hysteresis follows edges across the whole image, so it cannot run per tile
+    if (!settings->staged && !trace_edges && resolve_gaussian_engine(BLUR_KERNEL_SIZE, BLUR_SIGMA) == GAUSSIAN_ENGINE_FIR) {
+        // Blur, edges, XDoG tone and cell sampling fused per tile; only the cell grid reaches memory
+        TilePipeline pipeline = { BLUR_KERNEL_SIZE, BLUR_SIGMA, detect_edges, SOBEL_THRESHOLD, EDGE_COVERAGE,
+                                  stage_planned(settings->stages, STAGE_XDOG) ? &XDOG_OPTIONS : NULL };
+        grid = build_cell_grid_tiled(img, &pipeline, options, settings->output_width);
+    } else {
+        grid = build_staged_grid(img, settings);
+    }
+
+    if (stage_planned(settings->stages, STAGE_FDOG)) {
+        FlowDoGOptions flow = { FDOG_TENSOR_SIGMA, FDOG_SIGMA, XDOG_SIGMA_SCALE, FDOG_TAU, FDOG_FLOW_SIGMA, FDOG_PHI };
+        ToneField lines = apply_flow_dog(img, &flow);
+        apply_cell_tone(&grid, &lines);
+        free_tone_field(&lines);
+    }
+
+    ASCIIArt ascii_art = render_cell_grid(&grid, options);
+    free_cell_grid(&grid);
+    return ascii_art;
+}
+
+// Where the rows of a streamed conversion go: the saved text file (if any) and the console
+typedef struct {
+    FILE* file;
+    bool use_color;
+    bool write_failed;
+} StreamOutput;
+
+void write_stream_row(const ASCIIArt* row, void* context) {
+    StreamOutput* output = (StreamOutput*)context;
+    if (output->file && fwrite(row->data, 1, row->data_length, output->file) != row->data_length) {
+        output->write_failed = true;
+    }
+    if (output->use_color) {
+        fwrite(row->color_data, 1, row->color_data_length, stdout);
+    } else {
+        fwrite(row->data, 1, row->data_length, stdout);
+    }
+    fflush(stdout);
+}
+
+bool read_stream_pnm_row(uint8_t* row, void* context) {
+    return read_pnm_row((PnmRowReader*)context, row);
+}
+
+bool read_stream_png_row(uint8_t* row, void* context) {
+    return read_png_row((PngRowReader*)context, row);
+}
+
+// Row readers of a streamed conversion; `source` reads from whichever one opened the file
+typedef struct {
+    PnmRowReader pnm;
+    PngRowReader png;
+    RowSource source;
+} StreamInput;
+
+bool open_stream_input(const char* input_filename, ImageChannels layout, StreamInput* input) {
+    if (open_pnm_rows(input_filename, layout, &input->pnm)) {
+        RowSource source = { input->pnm.width, input->pnm.height, input->pnm.channels, read_stream_pnm_row, &input->pnm };
+        input->source = source;
+        return true;
+    }
+    if (open_png_rows(input_filename, layout, &input->png)) {
+        RowSource source = { input->png.width, input->png.height, input->png.channels, read_stream_png_row, &input->png };
+        input->source = source;
+        return true;
+    }
+    return false;
+}
+
+void close_stream_input(StreamInput* input) {
+    if (input->source.context == &input->pnm) {
+        close_pnm_rows(&input->pnm);
+    } else {
+        close_png_rows(&input->png);
+    }
+}
+
+// Why the filters of this conversion cannot run a row at a time, or NULL when they can
+const char* stream_filter_blocker(const ConversionSettings* settings) {
+    if (resolve_gaussian_engine(BLUR_KERNEL_SIZE, BLUR_SIGMA) != GAUSSIAN_ENGINE_FIR) {
+        return "the IIR blur";
+    }
+    if (stage_planned(settings->stages, STAGE_CANNY)) {
+        return "Canny edges";
+    }
+    if (stage_planned(settings->stages, STAGE_XDOG) || stage_planned(settings->stages, STAGE_FDOG)) {
+        return "the DoG tones";
+    }
+    return NULL;
+}
+
+// --stream: convert a binary PGM/PPM or a non-interlaced PNG a row at a time, saving and printing
+// every ASCII row as soon as it is done. When the file or the filters cannot be streamed, a
+// warning says why and false is returned before any output, leaving the caller to load it whole.
+bool stream_image(const char* input_filename, const char* output_path, const ConversionSettings* settings, bool use_color) {
+    StreamInput input;
+    const char* blocker = stream_filter_blocker(settings);
+    if (blocker == NULL && !open_stream_input(input_filename, settings->layout, &input)) {
+        blocker = "it is not a binary PPM/PGM or a non-interlaced PNG";
+    }
+
+    int working_width = 0;
+    int working_height = 0;
+    if (blocker == NULL) {
+        const RowSource* source = &input.source;
+        working_width = source->width;
+        working_height = source->height;
+        if (stage_planned(settings->stages, STAGE_RESIZE)) {
+            int ascii_height = compute_ascii_height(source->width, source->height, settings->output_width);
+            get_working_size(source->width, source->height, settings->output_width, ascii_height, WORKING_OVERSAMPLE,
+                             &working_width, &working_height);
+        }
+        if (compute_ascii_height(working_width, working_height, settings->output_width) > working_height) {
+            close_stream_input(&input);
+            blocker = "the text has more rows than the image";
+        }
+    }
+    if (blocker) {
+        fprintf(stderr, "Warning: --stream cannot convert %s (%s); loading it whole\n", input_filename, blocker);
+        return false;
+    }
+
+    StreamOutput output = { NULL, use_color, false };
+    if (output_path) {
+        output.file = fopen(output_path, "w");
+        if (output.file == NULL) {
+            error_exit("Error opening file %s for writing", output_path);
+        }
+    }
+
+    TilePipeline pipeline = { BLUR_KERNEL_SIZE, BLUR_SIGMA, stage_planned(settings->stages, STAGE_SOBEL), SOBEL_THRESHOLD,
+                              EDGE_COVERAGE, NULL };
+    bool complete = stream_ascii_rows(&input.source, working_width, working_height, &pipeline, &settings->options,
+                                      settings->output_width, write_stream_row, &output);
+    close_stream_input(&input);
+    if (output.file && fclose(output.file) != 0) {
+        output.write_failed = true;
+    }
+
+    if (!complete) {
+        error_exit("Failed to read image: %s", input_filename);
+    }
+    if (output.write_failed) {
+        error_exit("Error writing file %s", output_path);
+    }
+    if (output_path) {
+        printf("ASCII art saved to %s\n", output_path);
+    }
+    return true;
+}
+
+// Batch item: load, convert and save one image; failures are reported and the batch goes on
+bool convert_batch_item(const char* input_filename, void* context) {
+    const ConversionSettings* settings = (const ConversionSettings*)context;
+    char output_filename[OUTPUT_FILENAME_MAX];
+
+    Image img;
+    if (!try_load_image(input_filename, settings->layout, decode_min_width(settings), &img)) {
+        fprintf(stderr, "Error: Failed to load image %s (%s)\n", input_filename, image_load_failure());
+        return false;
+    }
+    prepare_working_image(&img, settings);
+    ASCIIArt ascii_art = convert_image(&img, settings);
+    free_image(&img);
+
+    bool saved = snprintf(output_filename, sizeof(output_filename), "%s_ascii.txt", input_filename) < (int)sizeof(output_filename) &&
+                 write_ascii_art(&ascii_art, output_filename);
+    if (!saved) {
+        fprintf(stderr, "Error: Failed to save ASCII art for %s\n", input_filename);
+    }
+    free_ascii_art(&ascii_art);
+    return saved;
+}
+
+// Pipeline stages of a batch: the same work as convert_batch_item, split where the I/O happens
+void* decode_batch_item(const char* input_filename, void* context) {
+    const ConversionSettings* settings = (const ConversionSettings*)context;
+
+    Image* img = (Image*)safe_malloc(sizeof(Image));
+    if (!try_load_image(input_filename, settings->layout, decode_min_width(settings), img)) {
+        fprintf(stderr, "Error: Failed to load image %s (%s)\n", input_filename, image_load_failure());
+        free(img);
+        return NULL;
+    }
+    prepare_working_image(img, settings);
+    return img;
+}
+
+void* process_batch_item(void* decoded, void* context) {
+    Image* img = (Image*)decoded;
+    ASCIIArt* ascii_art = (ASCIIArt*)safe_malloc(sizeof(ASCIIArt));
+
+    *ascii_art = convert_image(img, (const ConversionSettings*)context);
+    free_image(img);
+    free(img);
+    return ascii_art;
+}
+
+bool write_batch_item(const char* input_filename, void* processed, void* context) {
+    ASCIIArt* ascii_art = (ASCIIArt*)processed;
+    char output_filename[OUTPUT_FILENAME_MAX];
+    (void)context;
+
+    bool saved = snprintf(output_filename, sizeof(output_filename), "%s_ascii.txt", input_filename) < (int)sizeof(output_filename) &&
+                 write_ascii_art(ascii_art, output_filename);
+    if (!saved) {
+        fprintf(stderr, "Error: Failed to save ASCII art for %s\n", input_filename);
+    }
+    free_ascii_art(ascii_art);
+    free(ascii_art);
+    return saved;
 }
 
 #ifdef __EMSCRIPTEN__
@@ -32,34 +372,44 @@ char* generate_ascii_wasm(unsigned char* image_data, int width, int height, int
         .channels = channels
     };
 
-    Image blurred = apply_gaussian_blur(&img, 5, 1.0f);
-    Image edges = apply_dog_edge_detection(&blurred, 5, 1.0f, 1.6f, 0.99f, 0.1f);
-    EdgeInfo edge_info = apply_sobel_edge_detection(&blurred);
-    Image quantized_directions = quantize_edge_direction(&edge_info.direction);
-    ASCIIArt ascii_art = convert_to_ascii_with_color(&blurred, &quantized_directions, output_width);
+    // The page always draws Sobel edges over the plain blurred tones
+    StageRequest request = { use_color, false, true, false, false, false };
+    StageSet stages = plan_stages(&request);
 
-    // Allocate memory for the result string
-    char* result = (char*)malloc(strlen(use_color ? ascii_art.color_data : ascii_art.data) + 1);
-    if (!result) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return NULL;
+    // Filter a working image sized to the cell grid rather than the full decoded image
+    int ascii_height = compute_ascii_height(width, height, output_width);
+    Image working = create_working_image(&img, output_width, ascii_height, WORKING_OVERSAMPLE);
+
+    // Monochrome output only needs luma; filter one channel instead of four
+    if (stage_planned(stages, STAGE_LUMA)) {
+        convert_to_luma(&working);
+    }
+
+    Image blurred = apply_gaussian_blur(&working, BLUR_KERNEL_SIZE, BLUR_SIGMA);
+    free_image(&working);
+    Image edge_cells = {0};
+    if (stage_planned(stages, STAGE_SOBEL)) {
+        edge_cells = detect_cell_edges(&blurred, SOBEL_THRESHOLD, EDGE_COVERAGE, output_width,
+                                       compute_ascii_height(blurred.width, blurred.height, output_width));
     }
 
-    // Copy the appropriate ASCII art data to the result string
-    strcpy(result, use_color ? ascii_art.color_data : ascii_art.data);
+    GlyphTable glyphs;
+    build_glyph_table(&glyphs, ASCII_CHARS);
+    ASCIIOptions options = { &glyphs, true, 0, use_color ? ASCII_OUTPUT_COLOR : ASCII_OUTPUT_PLAIN };
+    ASCIIArt ascii_art = convert_to_ascii_with_color(&blurred, &edge_cells, &options, output_width);
+
+    // Only the requested representation was built; hand its buffer to the caller, who frees it
+    char* result = use_color ? ascii_art.color_data : ascii_art.data;
 
     free_image(&blurred);
-    free_image(&edges);
-    free_edge_info(&edge_info);
-    free_image(&quantized_directions);
-    free_ascii_art(&ascii_art);
+    free_image(&edge_cells);
 
     return result;
 }
 #endif
 
 int main(int argc, char* argv[]) {
-    if (argc < 2 || argc > 6) {
+    if (argc < 2) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
@@ -68,6 +418,24 @@ int main(int argc, char* argv[]) {
     int output_width = DEFAULT_OUTPUT_WIDTH;
     bool use_color = false;
     bool use_edge_detection = false;
+    bool full_resolution = false;
+    bool canny = false;
+    bool xdog = false;
+    bool fdog = false;
+    bool blur_report = false;
+    const char* charset = ASCII_CHARS;
+    int color_levels = 0;
+    bool coalesce_colors = true;
+    int threads = 0;
+    long long memory_limit_mb = DEFAULT_MEMORY_LIMIT_MB;
+    bool staged = false;
+    bool stream = false;
+    bool save = true;
+    const char* output_option = NULL;
+    bool batch = false;
+    bool pipelined = true;
+    bool explain = false;
+    BatchParallelism stages = { 0, 0, 0 };
 
     // Parse command-line arguments
     for (int i = 2; i < argc; i++) {
@@ -75,6 +443,70 @@ int main(int argc, char* argv[]) {
             use_color = true;
         } else if (strcmp(argv[i], "--edge") == 0 || strcmp(argv[i], "-e") == 0) {
             use_edge_detection = true;
+        } else if (strcmp(argv[i], "--canny") == 0) {
+            canny = true;
+        } else if (strcmp(argv[i], "--xdog") == 0) {
+            xdog = true;
+        } else if (strcmp(argv[i], "--fdog") == 0) {
+            fdog = true;
+        } else if (strcmp(argv[i], "--full-res") == 0 || strcmp(argv[i], "-f") == 0) {
+            full_resolution = true;
+        } else if (strcmp(argv[i], "--blur-engine") == 0 && i + 1 < argc) {
+            const char* engine = argv[++i];
+            if (strcmp(engine, "auto") == 0) {
+                set_gaussian_engine(GAUSSIAN_ENGINE_AUTO);
+            } else if (strcmp(engine, "fir") == 0) {
+                set_gaussian_engine(GAUSSIAN_ENGINE_FIR);
+            } else if (strcmp(engine, "iir") == 0) {
+                set_gaussian_engine(GAUSSIAN_ENGINE_IIR);
+            } else {
+                fprintf(stderr, "Error: Unknown blur engine %s\n", engine);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--blur-report") == 0) {
+            blur_report = true;
+        } else if (strcmp(argv[i], "--charset") == 0 && i + 1 < argc) {
+            charset = argv[++i];
+        } else if (strcmp(argv[i], "--color-levels") == 0 && i + 1 < argc) {
+            color_levels = atoi(argv[++i]);
+            if (color_levels < 2) {
+                fprintf(stderr, "Error: Invalid color level count\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--no-coalesce") == 0) {
+            coalesce_colors = false;
+        } else if (strcmp(argv[i], "--staged") == 0) {
+            staged = true;
+        } else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc) {
+            memory_limit_mb = atoll(argv[++i]);
+            if (memory_limit_mb < 0) {
+                fprintf(stderr, "Error: Invalid memory limit\n");
+                return EXIT_FAILURE;
+            }
+        } else if ((strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "-o") == 0) && i + 1 < argc) {
+            output_option = argv[++i];
+        } else if (strcmp(argv[i], "--no-save") == 0) {
+            save = false;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--no-pipeline") == 0) {
+            pipelined = false;
+        } else if (strcmp(argv[i], "--explain") == 0) {
+            explain = true;
+        } else if (strcmp(argv[i], "--stages") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d,%d,%d", &stages.decode, &stages.process, &stages.write) != 3 ||
+                stages.decode < 1 || stages.process < 1 || stages.write < 1) {
+                fprintf(stderr, "Error: Invalid stage thread counts\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 0) {
+                fprintf(stderr, "Error: Invalid thread count\n");
+                return EXIT_FAILURE;
+            }
         } else {
             int width = atoi(argv[i]);
             if (width > 0) {
@@ -86,62 +518,116 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // Each pair draws the same layer two ways; neither may win silently
+    if (use_edge_detection && canny) {
+        fprintf(stderr, "Error: --edge and --canny both draw the edges; give one of them\n");
+        return EXIT_FAILURE;
+    }
+    if (xdog && fdog) {
+        fprintf(stderr, "Error: --xdog and --fdog both shade the image; give one of them\n");
+        return EXIT_FAILURE;
+    }
+
+    thread_pool_init(threads);
+    set_image_memory_limit((size_t)memory_limit_mb << 20);
+
+    GlyphTable glyphs;
+    build_glyph_table(&glyphs, charset);
+    // A single image's text is saved to --output, or next to the input unless it came from stdin
+    char output_filename[OUTPUT_FILENAME_MAX];
+    const char* output_path = NULL;
+    if (save && output_option) {
+        output_path = output_option;
+    } else if (save && strcmp(input_filename, IMAGE_STDIN) != 0) {
+        snprintf(output_filename, sizeof(output_filename), "%s_ascii.txt", input_filename);
+        output_path = output_filename;
+    }
+
+    // The plain text is built when it is saved or printed, the colored text only when it is printed
+    bool render_color = use_color && !batch;
+    bool render_plain = batch || output_path || !render_color;
+    StageRequest request = { render_color, full_resolution, use_edge_detection, canny, xdog, fdog };
+    StageSet plan = plan_stages(&request);
+    ConversionSettings settings = {
+        output_width, staged, plan,
+        stage_planned(plan, STAGE_LUMA) ? IMAGE_CHANNELS_GRAY : IMAGE_CHANNELS_COLOR,
+        { &glyphs, coalesce_colors, color_levels, (render_plain ? ASCII_OUTPUT_PLAIN : 0) | (render_color ? ASCII_OUTPUT_COLOR : 0) }
+    };
+    if (explain) {
+        print_stage_plan(plan, &request, stderr);
+    }
+
+    if (batch) {
+        // Images are spread over the threads; the filter stages of each image run on its thread
+        BatchInputs inputs = collect_batch_inputs(input_filename);
+        BatchReport report;
+        if (pipelined) {
+            // The stage threads replace the pool; each image is processed on one of them
+            int cores = threads > 0 ? threads : available_cores();
+            if (stages.process == 0) {
+                stages.decode = max_int(cores / 2, 1);
+                stages.process = cores;
+                stages.write = 1;
+            }
+            thread_pool_init(1);
+            BatchStages callbacks = { decode_batch_item, process_batch_item, write_batch_item, &settings };
+            report = run_batch_pipeline(&inputs, &callbacks, &stages);
+        } else {
+            report = run_batch(&inputs, convert_batch_item, &settings);
+        }
+        double seconds = report.seconds > 0 ? report.seconds : 1e-9;
+        printf("Converted %d of %d images in %.2f s: %.1f images/sec, %.1f MB/sec\n",
+               report.converted, inputs.count, report.seconds,
+               report.converted / seconds, report.input_bytes / (1024.0 * 1024.0) / seconds);
+        free_batch_inputs(&inputs);
+        thread_pool_shutdown();
+        return report.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (stream && stream_image(input_filename, output_path, &settings, use_color)) {
+        thread_pool_shutdown();
+        return EXIT_SUCCESS;
+    }
+
     // Load the image
-    Image img = load_image(input_filename);
+    Image img = load_image(input_filename, settings.layout, decode_min_width(&settings));
     if (!img.data) {
         fprintf(stderr, "Error: Failed to load image %s\n", input_filename);
         return EXIT_FAILURE;
     }
 
-    // Apply Gaussian blur
-    Image blurred = apply_gaussian_blur(&img, 5, 1.0f);
-
-    // Initialize edges and quantized_directions as empty images
-    Image edges = {0};
-    Image quantized_directions = {0};
+    prepare_working_image(&img, &settings);
 
-    if (use_edge_detection) {
-        fprintf(stderr, "Warning: Edge detection is not implemented yet. Proceeding without edge detection.\n");
-        // TODO: Implement edge detection when it's working
-        // edges = apply_dog_edge_detection(&blurred, 5, 1.0f, 1.6f, 0.99f, 0.1f);
-        // EdgeInfo edge_info = apply_sobel_edge_detection(&blurred);
-        // quantized_directions = quantize_edge_direction(&edge_info.direction);
+    if (blur_report) {
+        print_blur_report(&img, BLUR_KERNEL_SIZE, BLUR_SIGMA);
     }
 
-    // Convert to ASCII with color
-    ASCIIArt ascii_art = convert_to_ascii_with_color(&blurred, &quantized_directions, output_width);
-    if (ascii_art.data == NULL || ascii_art.color_data == NULL) {
+    ASCIIArt ascii_art = convert_image(&img, &settings);
+    if ((use_color ? ascii_art.color_data : ascii_art.data) == NULL || (output_path && ascii_art.data == NULL)) {
         fprintf(stderr, "Error: Failed to convert image to ASCII art\n");
         // Clean up and return
         free_image(&img);
-        free_image(&blurred);
-        if (use_edge_detection) {
-            free_image(&edges);
-            free_image(&quantized_directions);
-        }
+        thread_pool_shutdown();
         return EXIT_FAILURE;
     }
 
-    // Generate output filename
-    char output_filename[256];
-    snprintf(output_filename, sizeof(output_filename), "%s_ascii.txt", input_filename);
-
     // Save ASCII art (always saves non-color version)
-    save_ascii_art(&ascii_art, output_filename);
-
-    printf("ASCII art saved to %s\n", output_filename);
+    if (output_path) {
+        save_ascii_art(&ascii_art, output_path);
+        printf("ASCII art saved to %s\n", output_path);
+    }
 
     // Print ASCII art to console (use color if specified)
-    printf("%s", use_color ? ascii_art.color_data : ascii_art.data);
+    if (use_color) {
+        fwrite(ascii_art.color_data, 1, ascii_art.color_data_length, stdout);
+    } else {
+        fwrite(ascii_art.data, 1, ascii_art.data_length, stdout);
+    }
 
     // Clean up
     free_image(&img);
-    free_image(&blurred);
-    if (use_edge_detection) {
-        free_image(&edges);
-        free_image(&quantized_directions);
-    }
     free_ascii_art(&ascii_art);
+    thread_pool_shutdown();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
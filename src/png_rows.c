@@ -0,0 +1,650 @@
+// png_rows.c
+
+#include "png_rows.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of the file read at a time
+#define PNG_READ_BUFFER_SIZE (1 << 16)
+
+// Largest width or height accepted, as stb's PNG decoder
+#define PNG_MAX_DIMENSION (1 << 24)
+
+// Deflate history a back-reference can reach
+#define INFLATE_WINDOW_SIZE 32768
+#define INFLATE_WINDOW_MASK (INFLATE_WINDOW_SIZE - 1)
+
+// Code bits resolved by one table lookup; longer codes are walked one bit at a time
+#define INFLATE_FAST_BITS 9
+
+// Longest deflate code, in bits
+#define INFLATE_MAX_BITS 15
+
+// Canonical Huffman code of one deflate alphabet
+typedef struct {
+    uint16_t fast[1 << INFLATE_FAST_BITS];  // Symbol << 4 | code length by the next bits; 0 for longer codes
+    uint16_t count[INFLATE_MAX_BITS + 1];   // Number of codes of each length
+    uint16_t symbols[288];                  // Symbols in code order
+} HuffmanTable;
+
+struct PngDecoder {
+    FILE* file;
+    uint8_t buffer[PNG_READ_BUFFER_SIZE];
+    size_t buffer_start;
+    size_t buffer_end;
+    uint32_t idat_remaining;  // Bytes left in the current IDAT chunk
+    bool idat_ended;          // A chunk other than IDAT followed the image data
+
+    // Inflate; bits are taken from the low end of `bits`
+    uint64_t bits;
+    int bit_count;
+    uint8_t window[INFLATE_WINDOW_SIZE];
+    uint64_t total_out;    // Bytes inflated so far; the window holds the last INFLATE_WINDOW_SIZE of them
+    int block_type;        // 0 stored, 1 fixed, 2 dynamic codes; -1 between blocks
+    bool final_block;
+    uint32_t stored_remaining;
+    int copy_length;       // Bytes of the current back-reference still to copy
+    int copy_distance;
+    HuffmanTable literals;
+    HuffmanTable distances;
+
+    // Rows
+    int color_type;
+    int bit_depth;
+    int samples;      // Samples per pixel as stored
+    int filter_unit;  // Bytes per complete pixel, at least 1, for the filters
+    size_t stride;    // Filtered bytes per row, without the filter type byte
+    uint8_t* previous;  // Filter type byte and unfiltered samples of the previous row
+    uint8_t* current;
+    uint8_t* pixels;    // The row expanded to 8-bit samples, palette colors looked up
+    int pixel_channels;
+    ImageChannels layout;
+    uint8_t palette[256 * 3];
+};
+
+static const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order the code length code lengths of a dynamic block are stored in
+static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Gray samples below 8 bits are scaled to 0-255 by these factors, as stb does
+static const uint8_t DEPTH_SCALE[9] = { 0, 0xff, 0x55, 0, 0x11, 0, 0, 0, 0x01 };
+
+// Next byte of the file; -1 at its end
+static int read_file_byte(PngDecoder* decoder) {
+    if (decoder->buffer_start == decoder->buffer_end) {
+        decoder->buffer_start = 0;
+        decoder->buffer_end = fread(decoder->buffer, 1, sizeof(decoder->buffer), decoder->file);
+        if (decoder->buffer_end == 0) {
+            return -1;
+        }
+    }
+    return decoder->buffer[decoder->buffer_start++];
+}
+
+static bool read_file_bytes(PngDecoder* decoder, uint8_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int byte = read_file_byte(decoder);
+        if (byte < 0) {
+            return false;
+        }
+        dst[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+static bool skip_file_bytes(PngDecoder* decoder, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (read_file_byte(decoder) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Next byte of the zlib stream, which runs on through consecutive IDAT chunks; -1 at its end
+static int next_data_byte(PngDecoder* decoder) {
+    while (decoder->idat_remaining == 0) {
+        // Skip the CRC of the chunk just finished, then continue only into another IDAT
+        uint8_t header[8];
+        if (decoder->idat_ended || !skip_file_bytes(decoder, 4) || !read_file_bytes(decoder, header, 8) ||
+            memcmp(header + 4, "IDAT", 4) != 0) {
+            decoder->idat_ended = true;
+            return -1;
+        }
+        decoder->idat_remaining = read_be32(header);
+    }
+    decoder->idat_remaining--;
+    return read_file_byte(decoder);
+}
+
+// Buffer at least `count` bits; false when the stream ends first (what it holds is kept)
+static bool need_bits(PngDecoder* decoder, int count) {
+    while (decoder->bit_count < count) {
+        int byte = next_data_byte(decoder);
+        if (byte < 0) {
+            return false;
+        }
+        decoder->bits |= (uint64_t)byte << decoder->bit_count;
+        decoder->bit_count += 8;
+    }
+    return true;
+}
+
+// Take `count` (at most 16) buffered bits
+static uint32_t take_bits(PngDecoder* decoder, int count) {
+    uint32_t value = (uint32_t)(decoder->bits & ((1u << count) - 1));
+    decoder->bits >>= count;
+    decoder->bit_count -= count;
+    return value;
+}
+
+// Canonical codes from the code length of each of `count` symbols; false when they are over-subscribed
+static bool build_huffman_table(HuffmanTable* table, const uint8_t* lengths, int count) {
+    uint16_t offsets[INFLATE_MAX_BITS + 2];
+    uint16_t next_code[INFLATE_MAX_BITS + 1];
+
+    memset(table->count, 0, sizeof(table->count));
+    for (int symbol = 0; symbol < count; symbol++) {
+        table->count[lengths[symbol]]++;
+    }
+    table->count[0] = 0;
+
+    int left = 1;
+    for (int length = 1; length <= INFLATE_MAX_BITS; length++) {
+        left = (left << 1) - table->count[length];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    offsets[1] = 0;
+    next_code[0] = 0;
+    for (int length = 1; length <= INFLATE_MAX_BITS; length++) {
+        offsets[length + 1] = (uint16_t)(offsets[length] + table->count[length]);
+        next_code[length] = (uint16_t)((next_code[length - 1] + table->count[length - 1]) << 1);
+    }
+
+    memset(table->fast, 0, sizeof(table->fast));
+    for (int symbol = 0; symbol < count; symbol++) {
+        int length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        table->symbols[offsets[length]++] = (uint16_t)symbol;
+
+        // Codes are stored from their first bit, so the table is indexed by the reversed code
+        int code = next_code[length]++;
+        if (length <= INFLATE_FAST_BITS) {
+            int reversed = 0;
+            for (int i = 0; i < length; i++) {
+                reversed |= ((code >> i) & 1) << (length - 1 - i);
+            }
+            for (int index = reversed; index < (1 << INFLATE_FAST_BITS); index += 1 << length) {
+                table->fast[index] = (uint16_t)(symbol << 4 | length);
+            }
+        }
+    }
+    return true;
+}
+
+// Next symbol of `table`; -1 on a bad code or the end of the stream
+static int decode_symbol(PngDecoder* decoder, const HuffmanTable* table) {
+    // The stream may end within INFLATE_MAX_BITS of a short final code; missing bits read as zero
+    need_bits(decoder, INFLATE_MAX_BITS);
+    uint16_t entry = table->fast[decoder->bits & ((1u << INFLATE_FAST_BITS) - 1)];
+    if (entry != 0) {
+        int length = entry & 15;
+        if (length > decoder->bit_count) {
+            return -1;
+        }
+        take_bits(decoder, length);
+        return entry >> 4;
+    }
+
+    // Longer codes: walk the canonical code one bit at a time
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length <= INFLATE_MAX_BITS && decoder->bit_count > 0; length++) {
+        code |= (int)take_bits(decoder, 1);
+        int count = table->count[length];
+        if (code - first < count) {
+            return table->symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static bool read_dynamic_tables(PngDecoder* decoder) {
+    uint8_t lengths[286 + 30];
+    uint8_t code_lengths[19];
+    HuffmanTable code_table;
+
+    if (!need_bits(decoder, 14)) {
+        return false;
+    }
+    int literal_count = (int)take_bits(decoder, 5) + 257;
+    int distance_count = (int)take_bits(decoder, 5) + 1;
+    int code_length_count = (int)take_bits(decoder, 4) + 4;
+    if (literal_count > 286 || distance_count > 30) {
+        return false;
+    }
+
+    memset(code_lengths, 0, sizeof(code_lengths));
+    for (int i = 0; i < code_length_count; i++) {
+        if (!need_bits(decoder, 3)) {
+            return false;
+        }
+        code_lengths[CODE_LENGTH_ORDER[i]] = (uint8_t)take_bits(decoder, 3);
+    }
+    if (!build_huffman_table(&code_table, code_lengths, 19)) {
+        return false;
+    }
+
+    int total = literal_count + distance_count;
+    for (int i = 0; i < total;) {
+        int symbol = decode_symbol(decoder, &code_table);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[i++] = (uint8_t)symbol;
+            continue;
+        }
+
+        // 16 repeats the previous length 3-6 times, 17 and 18 write 3-10 and 11-138 zeros
+        int repeat;
+        uint8_t value = 0;
+        if (symbol == 16) {
+            if (i == 0 || !need_bits(decoder, 2)) {
+                return false;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + (int)take_bits(decoder, 2);
+        } else if (symbol == 17) {
+            if (!need_bits(decoder, 3)) {
+                return false;
+            }
+            repeat = 3 + (int)take_bits(decoder, 3);
+        } else {
+            if (!need_bits(decoder, 7)) {
+                return false;
+            }
+            repeat = 11 + (int)take_bits(decoder, 7);
+        }
+        if (i + repeat > total) {
+            return false;
+        }
+        memset(lengths + i, value, (size_t)repeat);
+        i += repeat;
+    }
+
+    return lengths[256] != 0 && build_huffman_table(&decoder->literals, lengths, literal_count) &&
+           build_huffman_table(&decoder->distances, lengths + literal_count, distance_count);
+}
+
+static bool start_block(PngDecoder* decoder) {
+    if (!need_bits(decoder, 3)) {
+        return false;
+    }
+    decoder->final_block = take_bits(decoder, 1) != 0;
+    int type = (int)take_bits(decoder, 2);
+
+    if (type == 0) {
+        // Stored: byte-aligned length and its complement, then the bytes as they are
+        take_bits(decoder, decoder->bit_count & 7);
+        if (!need_bits(decoder, 32)) {
+            return false;
+        }
+        uint32_t length = take_bits(decoder, 16);
+        uint32_t complement = take_bits(decoder, 16);
+        if ((length ^ 0xFFFF) != complement) {
+            return false;
+        }
+        decoder->stored_remaining = length;
+    } else if (type == 1) {
+        uint8_t lengths[288 + 30];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        memset(lengths + 288, 5, 30);
+        build_huffman_table(&decoder->literals, lengths, 288);
+        build_huffman_table(&decoder->distances, lengths + 288, 30);
+    } else if (type != 2 || !read_dynamic_tables(decoder)) {
+        return false;
+    }
+    decoder->block_type = type;
+    return true;
+}
+
+static void put_window_byte(PngDecoder* decoder, uint8_t value) {
+    decoder->window[decoder->total_out & INFLATE_WINDOW_MASK] = value;
+    decoder->total_out++;
+}
+
+// Inflate exactly `count` bytes into dst; false on corrupt data or a stream that ends first
+static bool inflate_bytes(PngDecoder* decoder, uint8_t* dst, size_t count) {
+    size_t done = 0;
+
+    while (done < count) {
+        if (decoder->copy_length > 0) {
+            const uint8_t* window = decoder->window;
+            while (decoder->copy_length > 0 && done < count) {
+                uint8_t value = window[(decoder->total_out - decoder->copy_distance) & INFLATE_WINDOW_MASK];
+                put_window_byte(decoder, value);
+                dst[done++] = value;
+                decoder->copy_length--;
+            }
+            continue;
+        }
+
+        if (decoder->block_type < 0) {
+            if (decoder->final_block || !start_block(decoder)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (decoder->block_type == 0) {
+            if (decoder->stored_remaining == 0) {
+                decoder->block_type = -1;
+                continue;
+            }
+            // Whole bytes may still sit in the bit buffer from the block header
+            int byte = decoder->bit_count >= 8 ? (int)take_bits(decoder, 8) : next_data_byte(decoder);
+            if (byte < 0) {
+                return false;
+            }
+            put_window_byte(decoder, (uint8_t)byte);
+            dst[done++] = (uint8_t)byte;
+            decoder->stored_remaining--;
+            continue;
+        }
+
+        int symbol = decode_symbol(decoder, &decoder->literals);
+        if (symbol < 256) {
+            if (symbol < 0) {
+                return false;
+            }
+            put_window_byte(decoder, (uint8_t)symbol);
+            dst[done++] = (uint8_t)symbol;
+            continue;
+        }
+        if (symbol == 256) {
+            decoder->block_type = -1;
+            continue;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29 || !need_bits(decoder, LENGTH_EXTRA[symbol])) {
+            return false;
+        }
+        int length = LENGTH_BASE[symbol] + (int)take_bits(decoder, LENGTH_EXTRA[symbol]);
+        int distance_symbol = decode_symbol(decoder, &decoder->distances);
+        if (distance_symbol < 0 || distance_symbol >= 30 || !need_bits(decoder, DISTANCE_EXTRA[distance_symbol])) {
+            return false;
+        }
+        int distance = DISTANCE_BASE[distance_symbol] + (int)take_bits(decoder, DISTANCE_EXTRA[distance_symbol]);
+        if ((uint64_t)distance > decoder->total_out) {
+            return false;
+        }
+        decoder->copy_length = length;
+        decoder->copy_distance = distance;
+    }
+    return true;
+}
+
+static uint8_t paeth_predictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return (uint8_t)a;
+    }
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+// Undo the row filter of decoder->current (its type byte first) against the previous row
+static bool unfilter_row(PngDecoder* decoder) {
+    uint8_t* row = decoder->current + 1;
+    const uint8_t* above = decoder->previous + 1;
+    size_t stride = decoder->stride;
+    size_t unit = (size_t)decoder->filter_unit;
+
+    switch (decoder->current[0]) {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = unit; i < stride; i++) {
+            row[i] = (uint8_t)(row[i] + row[i - unit]);
+        }
+        break;
+    case 2:
+        for (size_t i = 0; i < stride; i++) {
+            row[i] = (uint8_t)(row[i] + above[i]);
+        }
+        break;
+    case 3:
+        for (size_t i = 0; i < stride; i++) {
+            int left = i >= unit ? row[i - unit] : 0;
+            row[i] = (uint8_t)(row[i] + ((left + above[i]) >> 1));
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < stride; i++) {
+            int left = i >= unit ? row[i - unit] : 0;
+            int corner = i >= unit ? above[i - unit] : 0;
+            row[i] = (uint8_t)(row[i] + paeth_predictor(left, above[i], corner));
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Samples of the unfiltered row as 8-bit values in decoder->pixels: 16-bit samples keep their high
+// byte, gray samples below 8 bits are scaled up and palette indices become RGB
+static void expand_row(PngDecoder* decoder, int width) {
+    const uint8_t* row = decoder->current + 1;
+    uint8_t* out = decoder->pixels;
+    size_t count = (size_t)width * decoder->samples;
+
+    if (decoder->bit_depth == 8) {
+        if (decoder->color_type == 3) {
+            for (size_t i = 0; i < count; i++) {
+                memcpy(out + i * 3, decoder->palette + row[i] * 3, 3);
+            }
+        } else {
+            memcpy(out, row, count);
+        }
+    } else if (decoder->bit_depth == 16) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = row[i * 2];
+        }
+    } else {
+        int depth = decoder->bit_depth;
+        int mask = (1 << depth) - 1;
+        for (size_t i = 0; i < count; i++) {
+            size_t bit = i * depth;
+            int value = (row[bit >> 3] >> (8 - depth - (int)(bit & 7))) & mask;
+            if (decoder->color_type == 3) {
+                memcpy(out + i * 3, decoder->palette + value * 3, 3);
+            } else {
+                out[i] = (uint8_t)(value * DEPTH_SCALE[depth]);
+            }
+        }
+    }
+}
+
+// Bit depths allowed for each color type
+static bool valid_png_format(int color_type, int bit_depth) {
+    switch (color_type) {
+    case 0:
+        return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+    case 3:
+        return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+    case 2:
+    case 4:
+    case 6:
+        return bit_depth == 8 || bit_depth == 16;
+    default:
+        return false;
+    }
+}
+
+// Chunks up to the first IDAT: the header, the palette, and anything else skipped
+static bool read_png_header(PngDecoder* decoder, PngRowReader* reader) {
+    static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t bytes[13];
+    bool have_header = false, have_palette = false;
+
+    if (!read_file_bytes(decoder, bytes, 8) || memcmp(bytes, SIGNATURE, 8) != 0) {
+        return false;
+    }
+
+    for (;;) {
+        if (!read_file_bytes(decoder, bytes, 8)) {
+            return false;
+        }
+        uint32_t length = read_be32(bytes);
+        char type[4];
+        memcpy(type, bytes + 4, 4);
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (have_header || length != 13 || !read_file_bytes(decoder, bytes, 13)) {
+                return false;
+            }
+            uint32_t width = read_be32(bytes), height = read_be32(bytes + 4);
+            decoder->bit_depth = bytes[8];
+            decoder->color_type = bytes[9];
+            // Compression and filter methods have one defined value; interlaced rows are out of order
+            if (width == 0 || height == 0 || width > PNG_MAX_DIMENSION || height > PNG_MAX_DIMENSION ||
+                !valid_png_format(decoder->color_type, decoder->bit_depth) || bytes[10] != 0 || bytes[11] != 0 ||
+                bytes[12] != 0) {
+                return false;
+            }
+            reader->width = (int)width;
+            reader->height = (int)height;
+            have_header = true;
+        } else if (!have_header || memcmp(type, "CgBI", 4) == 0) {
+            // The header comes first; Apple's CgBI files are not standard PNG
+            return false;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            if (length % 3 != 0 || length > sizeof(decoder->palette) || !read_file_bytes(decoder, decoder->palette, length)) {
+                return false;
+            }
+            have_palette = true;
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            decoder->idat_remaining = length;
+            return decoder->color_type != 3 || have_palette;
+        } else if (memcmp(type, "IEND", 4) == 0 || !skip_file_bytes(decoder, length)) {
+            return false;
+        }
+
+        // The CRC of every chunk before the image data
+        if (!skip_file_bytes(decoder, 4)) {
+            return false;
+        }
+    }
+}
+
+bool open_png_rows(const char* filename, ImageChannels layout, PngRowReader* reader) {
+    PngDecoder* decoder = (PngDecoder*)safe_calloc(1, sizeof(PngDecoder));
+    reader->decoder = NULL;
+    decoder->file = fopen(filename, "rb");
+    decoder->block_type = -1;
+    if (!decoder->file) {
+        free(decoder);
+        return false;
+    }
+
+    if (!read_png_header(decoder, reader)) {
+        fclose(decoder->file);
+        free(decoder);
+        return false;
+    }
+
+    // zlib header: deflate with a window of at most 32 KB and no preset dictionary
+    int method = next_data_byte(decoder);
+    int flags = next_data_byte(decoder);
+    if (method < 0 || flags < 0 || (method & 15) != 8 || (method >> 4) > 7 || (method * 256 + flags) % 31 != 0 ||
+        (flags & 32) != 0) {
+        fclose(decoder->file);
+        free(decoder);
+        return false;
+    }
+
+    static const int SAMPLES[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    decoder->samples = SAMPLES[decoder->color_type];
+    decoder->filter_unit = max_int(1, decoder->samples * decoder->bit_depth / 8);
+    decoder->stride = ((size_t)reader->width * decoder->samples * decoder->bit_depth + 7) / 8;
+    decoder->previous = (uint8_t*)safe_calloc(decoder->stride + 1, 1);
+    decoder->current = (uint8_t*)safe_malloc(decoder->stride + 1);
+    decoder->pixel_channels = decoder->color_type == 3 ? 3 : decoder->samples;
+    decoder->pixels = (uint8_t*)safe_malloc((size_t)reader->width * decoder->pixel_channels);
+    decoder->layout = layout;
+
+    // Same channels try_load_image produces: luma for gray output, one channel for gray files and
+    // RGB for color ones otherwise
+    reader->channels = layout == IMAGE_CHANNELS_GRAY || decoder->pixel_channels < 3 ? 1 : 3;
+    reader->decoder = decoder;
+    return true;
+}
+
+bool read_png_row(PngRowReader* reader, uint8_t* row) {
+    PngDecoder* decoder = reader->decoder;
+    if (!inflate_bytes(decoder, decoder->current, decoder->stride + 1) || !unfilter_row(decoder)) {
+        return false;
+    }
+    expand_row(decoder, reader->width);
+
+    // Alpha is dropped and gray output is Rec. 709 luma, as convert_to_luma makes it
+    int channels = decoder->pixel_channels;
+    if (reader->channels == 1) {
+        convert_row_to_luma(decoder->pixels, channels, reader->width, row);
+    } else if (channels == 3) {
+        memcpy(row, decoder->pixels, (size_t)reader->width * 3);
+    } else {
+        for (int x = 0; x < reader->width; x++) {
+            memcpy(row + (size_t)x * 3, decoder->pixels + (size_t)x * channels, 3);
+        }
+    }
+
+    uint8_t* previous = decoder->previous;
+    decoder->previous = decoder->current;
+    decoder->current = previous;
+    return true;
+}
+
+void close_png_rows(PngRowReader* reader) {
+    PngDecoder* decoder = reader->decoder;
+    if (decoder) {
+        fclose(decoder->file);
+        free(decoder->previous);
+        free(decoder->current);
+        free(decoder->pixels);
+        free(decoder);
+        reader->decoder = NULL;
+    }
+}
@@ -0,0 +1,30 @@
+// png_rows.h
+
+#ifndef PNG_ROWS_H
+#define PNG_ROWS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "image_loader.h"
+
+// Inflate and unfilter state of a PngRowReader, private to png_rows.c
+typedef struct PngDecoder PngDecoder;
+
+// Non-interlaced PNG read one row at a time, for images too large to load whole. Only the deflate
+// window, two rows and the read buffer are held, whatever the image height.
+typedef struct {
+    int width;
+    int height;
+    int channels;  // Channels of the rows read_png_row returns
+    PngDecoder* decoder;
+} PngRowReader;
+
+// Open a PNG for row reading with the channels load_image would give it (luma for gray output, one
+// channel for gray files, RGB otherwise; alpha is dropped). False for other files and for
+// interlaced PNGs, whose rows are not stored in order. read_png_row fills width * channels bytes
+// with exactly the samples stb would decode, and returns false on a read error or corrupt data.
+bool open_png_rows(const char* filename, ImageChannels layout, PngRowReader* reader);
+bool read_png_row(PngRowReader* reader, uint8_t* row);
+void close_png_rows(PngRowReader* reader);
+
+#endif // PNG_ROWS_H
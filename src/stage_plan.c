@@ -0,0 +1,93 @@
+// stage_plan.c
+
+#include "stage_plan.h"
+
+static const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "load", "luma", "resize", "blur", "xdog", "fdog", "sobel", "canny", "quantize", "cells", "render"
+};
+
+// Direct inputs of a stage under this request. This is the whole dependency graph: each render
+// mode only changes which edges exist, and plan_stages walks them from the render stage.
+static StageSet stage_inputs(Stage stage, const StageRequest* request) {
+    // Mono output filters luma from the start, so everything after load reads the luma image
+    StageSet source = request->color ? STAGE_BIT(STAGE_LOAD) : STAGE_BIT(STAGE_LUMA);
+
+    switch (stage) {
+    case STAGE_LOAD:
+        return 0;
+    case STAGE_LUMA:
+        return STAGE_BIT(STAGE_LOAD);
+    case STAGE_RESIZE:
+        return source;
+    case STAGE_BLUR:
+    case STAGE_FDOG:
+        // The flow-based DoG filters the working image itself, at its own sigmas
+        return request->full_resolution ? source : STAGE_BIT(STAGE_RESIZE);
+    case STAGE_XDOG:
+        // Sharpens the blur, deriving its surround Gaussian from it
+        return STAGE_BIT(STAGE_BLUR);
+    case STAGE_SOBEL:
+    case STAGE_CANNY:
+        return STAGE_BIT(STAGE_BLUR);
+    case STAGE_QUANTIZE:
+        return STAGE_BIT(STAGE_BLUR);
+    case STAGE_CELLS:
+        return STAGE_BIT(STAGE_BLUR) |
+               (request->sobel_edges ? STAGE_BIT(STAGE_SOBEL) : 0) |
+               (request->canny_edges ? STAGE_BIT(STAGE_CANNY) : 0) |
+               (request->xdog_tone ? STAGE_BIT(STAGE_XDOG) : 0) |
+               (request->fdog_lines ? STAGE_BIT(STAGE_FDOG) : 0) |
+               (request->color ? STAGE_BIT(STAGE_QUANTIZE) : 0);
+    case STAGE_RENDER:
+        return STAGE_BIT(STAGE_CELLS);
+    default:
+        return 0;
+    }
+}
+
+StageSet plan_stages(const StageRequest* request) {
+    StageSet stages = STAGE_BIT(STAGE_RENDER);
+
+    // Inputs always come earlier in the enum, so one pass from the end reaches the closure
+    for (int stage = STAGE_COUNT - 1; stage >= 0; stage--) {
+        if (stages & STAGE_BIT(stage)) {
+            stages |= stage_inputs((Stage)stage, request);
+        }
+    }
+    return stages;
+}
+
+bool stage_planned(StageSet stages, Stage stage) {
+    return (stages & STAGE_BIT(stage)) != 0;
+}
+
+void print_stage_plan(StageSet stages, const StageRequest* request, FILE* out) {
+    fprintf(out, "Plan:\n");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        if (!stage_planned(stages, (Stage)stage)) {
+            continue;
+        }
+
+        StageSet inputs = stage_inputs((Stage)stage, request);
+        fprintf(out, inputs ? "  %-9s" : "  %s", STAGE_NAMES[stage]);
+        const char* separator = "<- ";
+        for (int input = 0; input < STAGE_COUNT; input++) {
+            if (inputs & STAGE_BIT(input)) {
+                fprintf(out, "%s%s", separator, STAGE_NAMES[input]);
+                separator = ", ";
+            }
+        }
+        fprintf(out, "\n");
+    }
+
+    const char* separator = "Skipped: ";
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        if (!stage_planned(stages, (Stage)stage)) {
+            fprintf(out, "%s%s", separator, STAGE_NAMES[stage]);
+            separator = ", ";
+        }
+    }
+    if (separator[0] == ',') {
+        fprintf(out, "\n");
+    }
+}
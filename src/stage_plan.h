@@ -0,0 +1,48 @@
+// stage_plan.h
+
+#ifndef STAGE_PLAN_H
+#define STAGE_PLAN_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Stages of one conversion, in the order they run
+typedef enum {
+    STAGE_LOAD,      // Decode the image
+    STAGE_LUMA,      // Reduce it to one channel of luma
+    STAGE_RESIZE,    // Downsample to the working image
+    STAGE_BLUR,      // Gaussian blur
+    STAGE_XDOG,      // Extended difference-of-Gaussians tone field
+    STAGE_FDOG,      // Flow-based difference-of-Gaussians line field
+    STAGE_SOBEL,     // Per-cell edge glyphs voted by Sobel directions
+    STAGE_CANNY,     // Canny edge lines, voted into per-cell edge glyphs
+    STAGE_QUANTIZE,  // Quantized per-cell colors
+    STAGE_CELLS,     // Per-cell glyphs
+    STAGE_RENDER,    // Text
+    STAGE_COUNT
+} Stage;
+
+// Set of stages, one bit per Stage
+typedef unsigned StageSet;
+#define STAGE_BIT(stage) (1u << (stage))
+
+// What the chosen output consumes; it decides which inputs each stage reads
+typedef struct {
+    bool color;            // Colored text is rendered; otherwise luma is all that is needed
+    bool full_resolution;  // Filter the decoded image instead of a working image
+    bool sobel_edges;      // Edge glyphs from the Sobel operator
+    bool canny_edges;      // Edge glyphs from the Canny detector
+    bool xdog_tone;        // Glyph density from the XDoG tone field instead of the blurred image
+    bool fdog_lines;       // Glyph density from the flow-based DoG line field instead
+} StageRequest;
+
+// The stages the render stage transitively reads for this request; nothing else needs to run
+StageSet plan_stages(const StageRequest* request);
+
+// Whether stage is part of the plan
+bool stage_planned(StageSet stages, Stage stage);
+
+// Print the stages that run, each with the stages it reads, then the ones left out
+void print_stage_plan(StageSet stages, const StageRequest* request, FILE* out);
+
+#endif // STAGE_PLAN_H
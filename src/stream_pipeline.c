@@ -0,0 +1,187 @@
+// stream_pipeline.c
+
+#include "stream_pipeline.h"
+#include "cell_sampler.h"
+#include "edge_detection.h"
+#include "gaussian_blur.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// State of one stream_ascii_rows call
+typedef struct {
+    const RowSource* source;
+    const TilePipeline* pipeline;
+    const ASCIIOptions* options;
+    ASCIIRowCallback emit;
+    void* context;
+    int width;             // Working image
+    int height;
+    int channels;
+    int rows;              // ASCII rows
+    GaussianRowBlur blur;
+    uint8_t table[256];
+    const uint8_t* quantize;  // NULL when no colored text is rendered
+    CellGrid cells;        // One row of cells, rendered as soon as it is complete
+    int* cell_x0;          // Pixel columns of each cell
+    int* cell_x1;
+    uint8_t* window;       // Luma of blurred rows y - 2, y - 1 and y, for the Sobel taps
+    uint32_t* sums[2];     // Channel sums per cell, indexed by cell row parity
+    uint32_t* votes[2];    // Edge direction votes per cell, indexed the same way
+    int sum_row;           // Cell row the current blurred row belongs to
+    int emit_row;          // Next cell row to hand out
+} RowStream;
+
+// Cell rows partition the pixel rows here (there are no more cells than rows), so a cell row can
+// start collecting while the one before it waits for the edge taps below its last row
+static void emit_cell_row(RowStream* stream, int y0, int y1) {
+    int slot = stream->emit_row & 1;
+    uint32_t* sums = stream->sums[slot];
+    uint32_t* votes = stream->votes[slot];
+    int channels = stream->channels;
+
+    for (int cx = 0; cx < stream->cells.width; cx++) {
+        // Same sums and scale as sample_cell_mean, so the means match the summed-area table
+        int pixels = (stream->cell_x1[cx] - stream->cell_x0[cx]) * (y1 - y0);
+        float scale = 1.0f / (255.0f * pixels);
+        float mean[4];
+        for (int c = 0; c < channels; c++) {
+            mean[c] = sums[cx * channels + c] * scale;
+        }
+        uint8_t edge = 0;
+        if (stream->pipeline->detect_edges) {
+            edge = vote_cell_edge(votes + cx * EDGE_DIRECTIONS, pixels, stream->pipeline->edge_coverage);
+        }
+        set_cell(&stream->cells, cx, mean, channels, edge, stream->quantize);
+    }
+
+    ASCIIArt row = render_cell_grid(&stream->cells, stream->options);
+    stream->emit(&row, stream->context);
+    free_ascii_art(&row);
+
+    // The slot is reused two cell rows on
+    memset(sums, 0, (size_t)stream->cells.width * channels * sizeof(uint32_t));
+    memset(votes, 0, (size_t)stream->cells.width * EDGE_DIRECTIONS * sizeof(uint32_t));
+    stream->emit_row++;
+}
+
+static void stream_blurred_row(int y, const uint8_t* row, void* context) {
+    RowStream* stream = (RowStream*)context;
+    int channels = stream->channels;
+    int width = stream->width;
+
+    int y0, y1;
+    get_cell_bounds(stream->height, stream->rows, stream->sum_row, &y0, &y1);
+    if (y == y1) {
+        stream->sum_row++;
+        get_cell_bounds(stream->height, stream->rows, stream->sum_row, &y0, &y1);
+    }
+
+    uint32_t* sums = stream->sums[stream->sum_row & 1];
+    for (int cx = 0; cx < stream->cells.width; cx++) {
+        const uint8_t* p = row + (size_t)stream->cell_x0[cx] * channels;
+        int count = (stream->cell_x1[cx] - stream->cell_x0[cx]) * channels;
+        for (int i = 0; i < count; i += channels) {
+            for (int c = 0; c < channels; c++) {
+                sums[cx * channels + c] += p[i + c];
+            }
+        }
+    }
+
+    // Row y - 1 is now the middle row of the window, so its pixels vote for the cells they are in;
+    // border pixels are never edges, as in detect_cell_edges
+    if (stream->pipeline->detect_edges) {
+        memmove(stream->window, stream->window + width, 2 * (size_t)width);
+        convert_row_to_luma(row, channels, width, stream->window + 2 * (size_t)width);
+
+        if (y >= 2) {
+            int vote_row = y0 <= y - 1 ? stream->sum_row : stream->sum_row - 1;
+            uint32_t* votes = stream->votes[vote_row & 1];
+            const uint8_t* above = stream->window;
+            for (int cx = 0; cx < stream->cells.width; cx++) {
+                vote_sobel_row(above, above + width, above + 2 * width, max_int(stream->cell_x0[cx], 1),
+                               min_int(stream->cell_x1[cx], width - 1), stream->pipeline->edge_threshold,
+                               votes + cx * EDGE_DIRECTIONS);
+            }
+        }
+    }
+
+    // A cell row is done once its last row is summed and, with edges, the row below it has voted
+    while (stream->emit_row < stream->rows) {
+        get_cell_bounds(stream->height, stream->rows, stream->emit_row, &y0, &y1);
+        int ready = stream->pipeline->detect_edges ? min_int(y1, stream->height - 1) : y1 - 1;
+        if (y < ready) {
+            break;
+        }
+        emit_cell_row(stream, y0, y1);
+    }
+}
+
+static void push_working_row(int y, const uint8_t* row, void* context) {
+    (void)y;
+    RowStream* stream = (RowStream*)context;
+    push_blur_row(&stream->blur, row, stream_blurred_row, stream);
+}
+
+static bool read_source_row(uint8_t* row, void* context) {
+    const RowSource* source = ((const RowStream*)context)->source;
+    return source->read(row, source->context);
+}
+
+bool stream_ascii_rows(const RowSource* source, int working_width, int working_height, const TilePipeline* pipeline,
+                       const ASCIIOptions* options, int ascii_width, ASCIIRowCallback emit, void* context) {
+    RowStream stream;
+    int channels = source->channels;
+    size_t row_bytes = (size_t)working_width * channels;
+
+    stream.source = source;
+    stream.pipeline = pipeline;
+    stream.options = options;
+    stream.emit = emit;
+    stream.context = context;
+    stream.width = working_width;
+    stream.height = working_height;
+    stream.channels = channels;
+    stream.rows = compute_ascii_height(working_width, working_height, ascii_width);
+    stream.blur = create_row_blur(working_width, working_height, channels, pipeline->blur_kernel_size, pipeline->blur_sigma);
+    stream.quantize = prepare_color_quantizer(stream.table, options);
+    stream.cells = create_cell_grid(ascii_width, 1);
+    stream.cell_x0 = (int*)safe_malloc(ascii_width * sizeof(int));
+    stream.cell_x1 = (int*)safe_malloc(ascii_width * sizeof(int));
+    for (int cx = 0; cx < ascii_width; cx++) {
+        get_cell_bounds(working_width, ascii_width, cx, &stream.cell_x0[cx], &stream.cell_x1[cx]);
+    }
+    stream.window = (uint8_t*)safe_calloc(3, working_width);
+    for (int i = 0; i < 2; i++) {
+        stream.sums[i] = (uint32_t*)safe_calloc((size_t)ascii_width * channels, sizeof(uint32_t));
+        stream.votes[i] = (uint32_t*)safe_calloc((size_t)ascii_width * EDGE_DIRECTIONS, sizeof(uint32_t));
+    }
+    stream.sum_row = 0;
+    stream.emit_row = 0;
+
+    bool complete = true;
+    if (working_width == source->width && working_height == source->height) {
+        uint8_t* row = (uint8_t*)safe_malloc(row_bytes);
+        for (int y = 0; y < source->height && complete; y++) {
+            complete = source->read(row, source->context);
+            if (complete) {
+                push_blur_row(&stream.blur, row, stream_blurred_row, &stream);
+            }
+        }
+        free(row);
+    } else {
+        complete = resize_image_rows(source->width, source->height, channels, working_width, working_height,
+                                     read_source_row, push_working_row, &stream);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        free(stream.sums[i]);
+        free(stream.votes[i]);
+    }
+    free(stream.window);
+    free(stream.cell_x0);
+    free(stream.cell_x1);
+    free_cell_grid(&stream.cells);
+    free_row_blur(&stream.blur);
+    return complete;
+}
@@ -0,0 +1,32 @@
+// stream_pipeline.h
+
+#ifndef STREAM_PIPELINE_H
+#define STREAM_PIPELINE_H
+
+#include <stdbool.h>
+#include "image_loader.h"
+#include "ascii_converter.h"
+#include "tile_pipeline.h"
+
+// Source of a streamed conversion: width x height pixels of `channels` channels, read top to bottom
+typedef struct {
+    int width;
+    int height;
+    int channels;
+    ImageRowReader read;
+    void* context;
+} RowSource;
+
+// Receives each finished ASCII row (a one-row ASCIIArt with the representations options asks for)
+typedef void (*ASCIIRowCallback)(const ASCIIArt* row, void* context);
+
+// Row-at-a-time conversion for images too large to hold in memory. Source rows are resized to the
+// working size as they are read, blurred through a rolling window, checked for edges and summed
+// into their cells; each ASCII row is handed to `emit` as soon as its last pixel row is in. Memory
+// is a few dozen rows of the source and working widths. The rows equal what build_cell_grid_tiled
+// and render_cell_grid produce for the whole working image, as long as the grid has no more rows
+// than the working image (check with compute_ascii_height first). Returns false if a read failed.
+bool stream_ascii_rows(const RowSource* source, int working_width, int working_height, const TilePipeline* pipeline,
+                       const ASCIIOptions* options, int ascii_width, ASCIIRowCallback emit, void* context);
+
+#endif // STREAM_PIPELINE_H
@@ -0,0 +1,291 @@
+// thread_pool.c
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "thread_pool.h"
+#include "utils.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Bands per thread, so a slow band does not leave the other threads idle at the end
+#define BANDS_PER_THREAD 4
+
+#ifdef THREAD_POOL_SERIAL
+
+int available_cores(void) {
+    return 1;
+}
+
+void thread_pool_init(int threads) {
+    (void)threads;
+}
+
+void thread_pool_shutdown(void) {
+}
+
+int thread_pool_size(void) {
+    return 1;
+}
+
+void parallel_for(int count, int min_band, BandFunction fn, void* context) {
+    (void)min_band;
+    if (count > 0) {
+        fn(0, count, context);
+    }
+}
+
+void parallel_for_stealing(int count, BandFunction fn, void* context) {
+    for (int i = 0; i < count; i++) {
+        fn(i, i + 1, context);
+    }
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+    pthread_t* workers;
+    int worker_count;
+    bool shutdown;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    pthread_mutex_t submit_lock;  // Held for the duration of one parallel_for
+
+    // Current job, guarded by lock
+    BandFunction fn;
+    void* context;
+    int count;
+    int band_count;
+    int next_band;
+    int bands_done;
+} ThreadPool;
+
+static ThreadPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+    .submit_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Claim and run bands of the current job until none are left; called with lock held
+static void run_bands_locked(void) {
+    while (pool.fn && pool.next_band < pool.band_count) {
+        int band = pool.next_band++;
+        BandFunction fn = pool.fn;
+        void* context = pool.context;
+        int begin = (int)((long long)band * pool.count / pool.band_count);
+        int end = (int)((long long)(band + 1) * pool.count / pool.band_count);
+
+        pthread_mutex_unlock(&pool.lock);
+        fn(begin, end, context);
+        pthread_mutex_lock(&pool.lock);
+
+        if (++pool.bands_done == pool.band_count) {
+            pthread_cond_signal(&pool.work_done);
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    while (!pool.shutdown) {
+        if (pool.fn && pool.next_band < pool.band_count) {
+            run_bands_locked();
+        } else {
+            pthread_cond_wait(&pool.work_ready, &pool.lock);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+int available_cores(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+void thread_pool_init(int threads) {
+    thread_pool_shutdown();
+
+    if (threads <= 0) {
+        threads = available_cores();
+    }
+
+    pool.shutdown = false;
+    pool.worker_count = threads - 1;
+    if (pool.worker_count <= 0) {
+        pool.worker_count = 0;
+        return;
+    }
+
+    pool.workers = (pthread_t*)safe_malloc(pool.worker_count * sizeof(pthread_t));
+    for (int i = 0; i < pool.worker_count; i++) {
+        if (pthread_create(&pool.workers[i], NULL, worker_main, NULL) != 0) {
+            error_exit("Failed to start worker thread");
+        }
+    }
+}
+
+void thread_pool_shutdown(void) {
+    if (pool.worker_count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.shutdown = true;
+    pthread_cond_broadcast(&pool.work_ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.worker_count; i++) {
+        pthread_join(pool.workers[i], NULL);
+    }
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.worker_count = 0;
+}
+
+int thread_pool_size(void) {
+    return pool.worker_count + 1;
+}
+
+void parallel_for(int count, int min_band, BandFunction fn, void* context) {
+    if (count <= 0) {
+        return;
+    }
+
+    int band_count = count / (min_band > 0 ? min_band : 1);
+    band_count = min_int(band_count, thread_pool_size() * BANDS_PER_THREAD);
+    if (pool.worker_count == 0 || band_count <= 1 || pthread_mutex_trylock(&pool.submit_lock) != 0) {
+        fn(0, count, context);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.context = context;
+    pool.count = count;
+    pool.band_count = band_count;
+    pool.next_band = 0;
+    pool.bands_done = 0;
+    pthread_cond_broadcast(&pool.work_ready);
+
+    run_bands_locked();
+    while (pool.bands_done < pool.band_count) {
+        pthread_cond_wait(&pool.work_done, &pool.lock);
+    }
+    pool.fn = NULL;
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.submit_lock);
+}
+
+// Remaining items [begin, end) of one thread's share in parallel_for_stealing
+typedef struct {
+    pthread_mutex_t lock;
+    int begin;
+    int end;
+} StealRange;
+
+typedef struct {
+    StealRange* ranges;
+    int range_count;
+    BandFunction fn;
+    void* context;
+} StealJob;
+
+// Take the next item from the front of a share, or -1 when it is empty
+static int pop_front(StealRange* range) {
+    int item = -1;
+    pthread_mutex_lock(&range->lock);
+    if (range->begin < range->end) {
+        item = range->begin++;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return item;
+}
+
+// Move the back half of the largest other share into `own`; false when nothing is left anywhere
+static bool steal_half(StealJob* job, int own) {
+    for (;;) {
+        int victim = -1, largest = 0;
+        for (int i = 0; i < job->range_count; i++) {
+            // This only picks the victim; its count is rechecked when the steal takes its lock
+            if (i == own) {
+                continue;
+            }
+            pthread_mutex_lock(&job->ranges[i].lock);
+            int remaining = job->ranges[i].end - job->ranges[i].begin;
+            pthread_mutex_unlock(&job->ranges[i].lock);
+            if (remaining > largest) {
+                victim = i;
+                largest = remaining;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+
+        StealRange* range = &job->ranges[victim];
+        pthread_mutex_lock(&range->lock);
+        int remaining = range->end - range->begin;
+        int begin = range->end - (remaining + 1) / 2;
+        int end = range->end;
+        if (remaining > 0) {
+            range->end = begin;
+        }
+        pthread_mutex_unlock(&range->lock);
+
+        if (remaining > 0) {
+            pthread_mutex_lock(&job->ranges[own].lock);
+            job->ranges[own].begin = begin;
+            job->ranges[own].end = end;
+            pthread_mutex_unlock(&job->ranges[own].lock);
+            return true;
+        }
+    }
+}
+
+// One band per share: drain it front to back, then keep stealing until every share is empty
+static void steal_band(int begin, int end, void* context) {
+    StealJob* job = (StealJob*)context;
+
+    for (int own = begin; own < end; own++) {
+        do {
+            int item;
+            while ((item = pop_front(&job->ranges[own])) >= 0) {
+                job->fn(item, item + 1, job->context);
+            }
+        } while (steal_half(job, own));
+    }
+}
+
+void parallel_for_stealing(int count, BandFunction fn, void* context) {
+    if (count <= 0) {
+        return;
+    }
+
+    StealJob job;
+    job.range_count = min_int(thread_pool_size(), count);
+    job.ranges = (StealRange*)safe_malloc(job.range_count * sizeof(StealRange));
+    job.fn = fn;
+    job.context = context;
+    for (int i = 0; i < job.range_count; i++) {
+        pthread_mutex_init(&job.ranges[i].lock, NULL);
+        job.ranges[i].begin = (int)((long long)i * count / job.range_count);
+        job.ranges[i].end = (int)((long long)(i + 1) * count / job.range_count);
+    }
+
+    parallel_for(job.range_count, 1, steal_band, &job);
+
+    for (int i = 0; i < job.range_count; i++) {
+        pthread_mutex_destroy(&job.ranges[i].lock);
+    }
+    free(job.ranges);
+}
+
+#endif
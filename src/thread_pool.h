@@ -0,0 +1,36 @@
+// thread_pool.h
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Builds without thread support (plain Emscripten) run everything on the calling thread
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define THREAD_POOL_SERIAL 1
+#endif
+
+// Work for one band of the range, [begin, end)
+typedef void (*BandFunction)(int begin, int end, void* context);
+
+// Number of online cores (1 when threads are unavailable)
+int available_cores(void);
+
+// Start the shared pool with `threads` threads in total, including the caller (0 = one per core)
+void thread_pool_init(int threads);
+
+// Stop and join the pool's worker threads
+void thread_pool_shutdown(void);
+
+// Number of threads parallel_for spreads work over (1 when the pool is not running)
+int thread_pool_size(void);
+
+// Split [0, count) into bands of at least min_band and run fn on every band, returning once all
+// are done. The caller works on bands too. Calls made while the pool is busy (nested calls from
+// inside a band, or from another thread) run inline on the calling thread.
+void parallel_for(int count, int min_band, BandFunction fn, void* context);
+
+// Run fn once per item of [0, count) (as the band [i, i + 1)) for items of very uneven cost.
+// Every thread starts on its own contiguous share and, once that runs dry, steals the back half
+// of the largest share left, so no thread idles while work remains.
+void parallel_for_stealing(int count, BandFunction fn, void* context);
+
+#endif // THREAD_POOL_H
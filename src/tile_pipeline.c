@@ -0,0 +1,210 @@
+// tile_pipeline.c
+
+#include "tile_pipeline.h"
+#include "cell_sampler.h"
+#include "edge_detection.h"
+#include "gaussian_blur.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <stdlib.h>
+
+// Tiles cover about TILE_TARGET_SIZE x TILE_TARGET_SIZE source pixels, so the blurred tile and the
+// horizontal pass behind it (under 200 KB for RGBA) stay in L2 while they are used
+#define TILE_TARGET_SIZE 128
+
+// State shared by all tiles of one build_cell_grid_tiled call
+typedef struct {
+    const Image* src;
+    const TilePipeline* pipeline;
+    GaussianRegionBlur blur;
+    GaussianRegionBlur surround;  // XDoG surround, blurred from the tile's blur
+    int halo;                     // Blurred pixels around a tile's cells: the Sobel taps and the surround
+    uint8_t table[256];
+    const uint8_t* quantize;  // NULL when no colored text is rendered
+    CellGrid* grid;
+    int tile_columns;  // Cells per tile horizontally
+    int tile_rows;     // Cells per tile vertically
+    int tiles_across;
+} TileJob;
+
+// Scratch space of one band of tiles, grown to the largest tile and reused
+typedef struct {
+    uint8_t* blurred;
+    size_t blurred_capacity;
+    uint8_t* luma;  // Luma of the blurred tile for the Sobel taps; unused for gray images
+    size_t luma_capacity;
+    uint8_t* surround;  // XDoG surround and tone of the tile's cells
+    size_t surround_capacity;
+    uint8_t* tone;
+    size_t tone_capacity;
+} TileBuffers;
+
+static uint8_t* reserve_buffer(uint8_t** buffer, size_t* capacity, size_t needed) {
+    if (needed > *capacity) {
+        *buffer = (uint8_t*)safe_realloc(*buffer, needed);
+        *capacity = needed;
+    }
+    return *buffer;
+}
+
+// Blur one tile of cells plus a halo for the Sobel taps and the XDoG surround, then fill its cells
+static void process_tile(const TileJob* job, int tile, TileBuffers* buffers) {
+    const Image* src = job->src;
+    CellGrid* grid = job->grid;
+    int channels = src->channels;
+
+    int cx0 = (tile % job->tiles_across) * job->tile_columns;
+    int cy0 = (tile / job->tiles_across) * job->tile_rows;
+    int cx1 = min_int(cx0 + job->tile_columns, grid->width);
+    int cy1 = min_int(cy0 + job->tile_rows, grid->height);
+
+    // Pixel bounds of the tile; cell bounds never decrease, so the first and last cells span it
+    int px0, px1, py0, py1, unused;
+    get_cell_bounds(src->width, grid->width, cx0, &px0, &unused);
+    get_cell_bounds(src->width, grid->width, cx1 - 1, &unused, &px1);
+    get_cell_bounds(src->height, grid->height, cy0, &py0, &unused);
+    get_cell_bounds(src->height, grid->height, cy1 - 1, &unused, &py1);
+
+    int bx0 = max_int(px0 - job->halo, 0);
+    int by0 = max_int(py0 - job->halo, 0);
+    int bx1 = min_int(px1 + job->halo, src->width);
+    int by1 = min_int(py1 + job->halo, src->height);
+    int tile_width = bx1 - bx0;
+    size_t stride = (size_t)tile_width * channels;
+
+    uint8_t* blurred = reserve_buffer(&buffers->blurred, &buffers->blurred_capacity, stride * (by1 - by0));
+    blur_image_region(&job->blur, src, bx0, by0, bx1, by1, blurred);
+
+    uint8_t* luma = blurred;
+    if (job->pipeline->detect_edges && channels > 1) {
+        luma = reserve_buffer(&buffers->luma, &buffers->luma_capacity, (size_t)tile_width * (by1 - by0));
+        for (int y = 0; y < by1 - by0; y++) {
+            convert_row_to_luma(blurred + (size_t)y * stride, channels, tile_width, luma + (size_t)y * tile_width);
+        }
+    }
+
+    // XDoG tone of the cells' pixels. The blurred tile reaches the image border or a full halo past
+    // the cells, so the surround clamps exactly where a blur of the whole image would.
+    const XDoGOptions* xdog = job->pipeline->xdog;
+    int cells_width = px1 - px0;
+    uint16_t* tone = NULL;
+    if (xdog) {
+        Image tile_image = { tile_width, by1 - by0, channels, blurred, NULL, 0 };
+        size_t cells_stride = (size_t)cells_width * channels;
+        uint8_t* surround = reserve_buffer(&buffers->surround, &buffers->surround_capacity, cells_stride * (py1 - py0));
+        blur_image_region(&job->surround, &tile_image, px0 - bx0, py0 - by0, px1 - bx0, py1 - by0, surround);
+
+        tone = (uint16_t*)reserve_buffer(&buffers->tone, &buffers->tone_capacity,
+                                         (size_t)cells_width * (py1 - py0) * sizeof(uint16_t));
+        for (int y = py0; y < py1; y++) {
+            xdog_tone_pixels(blurred + (size_t)(y - by0) * stride + (size_t)(px0 - bx0) * channels,
+                             surround + (size_t)(y - py0) * cells_stride, cells_width, channels, xdog,
+                             tone + (size_t)(y - py0) * cells_width);
+        }
+    }
+
+    for (int cy = cy0; cy < cy1; cy++) {
+        int y0, y1;
+        get_cell_bounds(src->height, grid->height, cy, &y0, &y1);
+
+        for (int cx = cx0; cx < cx1; cx++) {
+            int x0, x1;
+            get_cell_bounds(src->width, grid->width, cx, &x0, &x1);
+
+            // Same sums and scale as sample_cell_mean, so the means match the summed-area table. With
+            // XDoG the tone picks the glyph, and the means are only summed for the cell colors.
+            uint32_t sum[4] = {0, 0, 0, 0};
+            if (!xdog || job->quantize) {
+                for (int y = y0; y < y1; y++) {
+                    const uint8_t* p = blurred + (size_t)(y - by0) * stride + (size_t)(x0 - bx0) * channels;
+                    for (int i = 0; i < (x1 - x0) * channels; i += channels) {
+                        for (int c = 0; c < channels; c++) {
+                            sum[c] += p[i + c];
+                        }
+                    }
+                }
+            }
+            float scale = 1.0f / (255.0f * (x1 - x0) * (y1 - y0));
+            float mean[4];
+            for (int c = 0; c < channels; c++) {
+                mean[c] = sum[c] * scale;
+            }
+
+            // Every interior pixel votes, as in detect_cell_edges; border pixels are never edges
+            uint8_t edge = 0;
+            if (job->pipeline->detect_edges) {
+                uint32_t votes[EDGE_DIRECTIONS] = {0, 0, 0, 0};
+                int vx0 = max_int(x0, 1) - bx0;
+                int vx1 = min_int(x1, src->width - 1) - bx0;
+                for (int y = max_int(y0, 1); y < min_int(y1, src->height - 1); y++) {
+                    const uint8_t* center = luma + (size_t)(y - by0) * tile_width;
+                    vote_sobel_row(center - tile_width, center, center + tile_width, vx0, vx1,
+                                   job->pipeline->edge_threshold, votes);
+                }
+                edge = vote_cell_edge(votes, (x1 - x0) * (y1 - y0), job->pipeline->edge_coverage);
+            }
+
+            size_t cell = (size_t)cy * grid->width + cx;
+            set_cell(grid, cell, mean, channels, edge, job->quantize);
+
+            if (xdog) {
+                uint64_t tone_sum = 0;
+                for (int y = y0; y < y1; y++) {
+                    const uint16_t* t = tone + (size_t)(y - py0) * cells_width + (x0 - px0);
+                    for (int x = 0; x < x1 - x0; x++) {
+                        tone_sum += t[x];
+                    }
+                }
+                set_cell_tone(grid, cell, tone_sum, (x1 - x0) * (y1 - y0));
+            }
+        }
+    }
+}
+
+static void tile_band(int begin, int end, void* context) {
+    const TileJob* job = (const TileJob*)context;
+
+    // One set of buffers per band, reused (and so kept warm) across its tiles
+    TileBuffers buffers = { NULL, 0, NULL, 0, NULL, 0, NULL, 0 };
+    for (int tile = begin; tile < end; tile++) {
+        process_tile(job, tile, &buffers);
+    }
+    free(buffers.blurred);
+    free(buffers.luma);
+    free(buffers.surround);
+    free(buffers.tone);
+}
+
+CellGrid build_cell_grid_tiled(const Image* src, const TilePipeline* pipeline, const ASCIIOptions* options, int ascii_width) {
+    CellGrid grid = create_cell_grid(ascii_width, compute_ascii_height(src->width, src->height, ascii_width));
+
+    TileJob job;
+    job.src = src;
+    job.pipeline = pipeline;
+    job.blur = create_region_blur(pipeline->blur_kernel_size, pipeline->blur_sigma);
+    job.surround.kernel_size = 0;
+    job.surround.weights = NULL;
+    job.halo = 1;  // The Sobel taps of the cells' pixels need one more pixel on every side
+    if (pipeline->xdog) {
+        int surround_kernel_size;
+        float surround_sigma;
+        get_xdog_surround_blur(pipeline->blur_kernel_size, pipeline->blur_sigma, pipeline->xdog, &surround_kernel_size,
+                               &surround_sigma);
+        job.surround = create_region_blur(surround_kernel_size, surround_sigma);
+        job.halo = max_int(job.halo, surround_kernel_size / 2);
+    }
+    job.quantize = prepare_color_quantizer(job.table, options);
+    job.grid = &grid;
+
+    // Whole cells per tile, as close to the target pixel size as the cell size allows
+    job.tile_columns = max_int(1, (int)((long long)TILE_TARGET_SIZE * grid.width / src->width));
+    job.tile_rows = max_int(1, (int)((long long)TILE_TARGET_SIZE * grid.height / src->height));
+    job.tiles_across = (grid.width + job.tile_columns - 1) / job.tile_columns;
+    int tiles_down = (grid.height + job.tile_rows - 1) / job.tile_rows;
+
+    parallel_for(job.tiles_across * tiles_down, 1, tile_band, &job);
+
+    free_region_blur(&job.blur);
+    free_region_blur(&job.surround);
+    return grid;
+}
@@ -0,0 +1,28 @@
+// tile_pipeline.h
+
+#ifndef TILE_PIPELINE_H
+#define TILE_PIPELINE_H
+
+#include <stdbool.h>
+#include "image_loader.h"
+#include "ascii_converter.h"
+#include "edge_detection.h"
+
+// Stages run by build_cell_grid_tiled
+typedef struct {
+    int blur_kernel_size;
+    float blur_sigma;
+    bool detect_edges;     // Sobel edge glyphs, as detect_cell_edges
+    float edge_threshold;  // Threshold passed to detect_cell_edges
+    float edge_coverage;   // Coverage passed to detect_cell_edges
+    const XDoGOptions* xdog;  // Glyph density from the XDoG tone of the blur instead of its brightness; NULL for none
+} TilePipeline;
+
+// Blur, Sobel and cell sampling fused per tile: each tile of cells is blurred (with its halo) into
+// a small buffer that stays in cache, every pixel of a cell votes on its edge, and only the cell
+// grid is written to memory. Produces the same grid as blurring the whole image with the FIR
+// engine, running detect_cell_edges on it and calling build_cell_grid (then apply_cell_tone with
+// apply_xdog of the blur, whose surround is blurred from the tile's blur here).
+CellGrid build_cell_grid_tiled(const Image* src, const TilePipeline* pipeline, const ASCIIOptions* options, int ascii_width);
+
+#endif // TILE_PIPELINE_H
@@ -1,5 +1,7 @@
 // utils.c
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +9,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <time.h>
 #include "utils.h"
 
 // Define PI if it's not already defined
@@ -100,6 +103,14 @@ const char* get_file_extension(const char* filename) {
     return dot + 1;
 }
 
+long long get_file_size(const char* filename) {
+    struct stat buffer;
+    if (stat(filename, &buffer) != 0) {
+        return -1;
+    }
+    return (long long)buffer.st_size;
+}
+
 // String utilities
 void string_to_lower(char* str) {
     for (char* p = str; *p; p++) {
@@ -126,6 +137,13 @@ char* trim_string(char* str) {
     return str;
 }
 
+// Time utilities
+double get_time_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
 // Error handling
 void error_exit(const char* format, ...) {
     va_list args;
@@ -27,11 +27,15 @@ void* safe_realloc(void* ptr, size_t size);
 bool file_exists(const char* filename);
 bool create_directory(const char* path);
 const char* get_file_extension(const char* filename);
+long long get_file_size(const char* filename);  // -1 if it cannot be read
 
 // String utilities
 void string_to_lower(char* str);
 char* trim_string(char* str);
 
+// Time utilities
+double get_time_seconds(void);  // Monotonic wall-clock time
+
 // Error handling
 void error_exit(const char* format, ...);
 